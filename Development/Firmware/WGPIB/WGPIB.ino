@@ -0,0 +1,241 @@
+/*
+Program acts as a system GPIB controller using Wi-Fi or USB (FT230X UART).
+It is a port of USB GPIB Controller firmware BSC.C V2.5 (ATmega8515,
+Documents/hardware/bsc) to the WGPIB board. Host protocol is the one of BSC.C,
+see bsc.cpp for the supported commands.
+
+Host links:
+	UART0 (FT230X, USB)		BSC protocol, UartBaud
+	TCP port BscPort		BSC protocol, one connection at a time
+	TCP ports ScpiPort...	raw socket (LXI port 5025), port ScpiPort+i is bound to GPIB
+							address ScpiAddr+i; up to ScpiMax connections (scpi.cpp)
+	TCP port HisPort		HiSLIP (IVI-6.1), synchronous and asynchronous channel of
+							up to 4 sessions; sub-address gpib0,<a> selects the address (hislip.cpp)
+	HTTP port 80			/metrics, performance counters as IBP command
+
+Tasks:
+	core 1	GpTask		GPIB engine (gpib.cpp); handshake loops run from IRAM
+	core 0	Wi-Fi, TCP/IP, UartTask, TcpTask, ScpiTask, HisTask and their connections, UdpTask, HttpTask
+The host tasks talk to the engine only through lock-free single-producer/single-consumer
+rings (ring.h) for operations, events and data; a command of one host task is not
+interleaved with others. The bus is given to sessions by the scheduler of gpib.cpp
+(GpLock): SRQ handling first, then queries, then long reads, fair by bus time within
+a class; a long read gives the bus between parts only to sessions of other devices.
+Bus timing thus does not depend on Wi-Fi load.
+Arduino loop task is deleted, so GpTask is alone on core 1.
+
+Pin map (WGPIB.SchDoc Rev.0, net names; verify against the schematic for other revisions):
+	DIO1-8		GPIO 22, 2, 32, 33, 25, 26, 27, 14	via TXS0108E U2
+	REN			GPIO 23		via TXS0108E U3
+	IFC			GPIO 21
+	NDAC		GPIO 19
+	NRFD		GPIO 18
+	DAV			GPIO 5
+	EOI			GPIO 17
+	ATN			GPIO 16
+	SRQ			GPIO 4
+	TE			GPIO 13		SN75160/162 talk enable, LED DS5
+	DC			GPIO 15		SN75162 direction control, LED DS4
+	RXD0, TXD0	GPIO 3, 1	FT230X; RTS# and CTS# are not connected
+	GPIO 2, 5, 12 and 15 are strapping pins; GPIO 12 is pulled low by R10.
+
+Hardware: ESP-WROOM-32, FT230X, TXS0108E, SN75160/162, WGPIB Rev.0
+FW V1.0.0, October 2026
+
+
+/********
+Updates in V1.0.0 version Oct. 2026:
+
+- First version. Bus routines of BSC.C ported to ESP32 (gpib.cpp), engine task pinned to core 1
+  with handshake loops in IRAM, host sessions on core 0 connected by SPSC rings.
+- BSC protocol over UART and TCP (bsc.cpp, link.cpp), HTTP /metrics.
+- DIO byte and handshake lines written with W1TS/W1TC masks from compile-time tables (dio.h),
+  a byte is accepted with one sample of the GPIO input registers.
+- Store-and-forward read IBM to PSRAM (heap without PSRAM) at bus speed, ranged fetch IBG
+  without holding the bus.
+- Raw socket server on ports 5025..., a connection per GPIB address, data passed between
+  socket and engine rings without copies (scpi.cpp). GpSim in gpib.h simulates the bus.
+- HiSLIP server on port 4880 with overlapped mode, SRQ pushed on the asynchronous channel,
+  device clear, status query, locks and remote/local control (hislip.cpp).
+- Bus scheduler: classes SRQ, query and bulk, fair queuing by bus time within a class; long
+  reads are split into parts so a query waits for one part at most. Queue metrics.
+- UDP streaming on port 5030 (udp.cpp): a device is polled and its responses are sent to a
+  registered receiver as sequenced datagrams; gaps are found by sequence numbers and idle
+  heartbeats, the last 16 datagrams are sent again on request. Receiver in
+  Development/Host/udprx.py.
+- COBS framing of BSC data blocks (IBF1): frames of up to 1024 bytes with CRC-32, ended by a
+  zero byte; binary data is not inflated by DLE stuffing.
+- UART on the ESP-IDF driver with 16 KB/8 KB ring buffers and FIFO thresholds for 3 Mbaud,
+  interrupt on core 0; rate negotiated with IBu (confirmed at the new rate or set back).
+- Compression of BSC data blocks (IBL1, lz.cpp): 4 KB chunks packed by a block LZ codec
+  with fixed memory, sent raw when they do not shrink; compression pauses on data which
+  does not compress. Host decoder in Development/Host/bsclz.py.
+- Host build on Linux with the simulated bus (host/, make test): FreeRTOS, lwIP and the UART
+  driver stand on POSIX; tests of scheduler, raw socket, HiSLIP, UDP, COBS and compression.
+
+*/
+
+#include <WiFi.h>
+#include <WebServer.h>
+#include <lwip/sockets.h>
+#include <netinet/tcp.h>
+#include "gpib.h"
+#include "link.h"
+#include "bsc.h"
+#include "scpi.h"
+#include "hislip.h"
+#include "udp.h"
+
+// Settings
+#define WifiSsid ""				// Network; Wi-Fi is off if empty
+#define WifiPass ""
+#define UartBaud 115200			// Rate after reset; the host sets up to 3 Mbaud with IBu
+#define BscPort 5000			// TCP port of BSC protocol
+#define ScpiPort 5025			// Raw socket port of GPIB address ScpiAddr, next ports of next addresses
+#define ScpiAddr 1
+#define ScpiCnt 4				// Number of ports (addresses)
+#define ScpiMax 4				// Connections at a time
+#define HisPort 4880			// HiSLIP port
+#define HisAddr 1				// GPIB address of sub-address hislip0
+#define HisConnMax 8			// Connections at a time, two per session
+#define UdpPort 5030			// UDP streaming, requests of the receiver
+#define HttpPort 80
+
+static Link UartLnk, TcpLnk;
+static WebServer Http(HttpPort);
+
+
+//Task runs BSC protocol on UART; it starts the UART so its interrupt is on core 0.
+static void UartTask(void *arg){
+	LnkUartBegin(UartBaud);
+	LnkInit(&UartLnk,LnkUart);
+	for(;;) BscRun(&UartLnk);
+}
+
+
+//Task runs BSC protocol on TCP connections, one at a time.
+static void TcpTask(void *arg){
+	int srv, fd, on=1;
+	while((srv=TcpListen(BscPort))<0) vTaskDelay(1000);
+	for(;;){
+		fd=accept(srv,0,0);
+		if(fd<0) continue;
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+		LnkInit(&TcpLnk,fd);
+		BscRun(&TcpLnk);
+		close(fd);
+	}
+}
+
+
+static volatile int ScpiConns=0;
+
+//Task runs raw socket session of one connection; arg is socket<<8 | GPIB address.
+static void ScpiConn(void *arg){
+	int fd=(intptr_t)arg>>8;
+	ScpiRun(fd,(intptr_t)arg&0xff);
+	close(fd);
+	__atomic_sub_fetch(&ScpiConns,1,__ATOMIC_SEQ_CST);
+	vTaskDelete(NULL);
+}
+
+//Task accepts raw socket connections on ScpiCnt ports.
+static void ScpiTask(void *arg){
+	int srv[ScpiCnt], fd, i, m;
+	fd_set fs;
+	for(i=0;i<ScpiCnt;i++) while((srv[i]=TcpListen(ScpiPort+i))<0) vTaskDelay(1000);
+	for(;;){
+		FD_ZERO(&fs);
+		for(i=m=0;i<ScpiCnt;i++){
+			FD_SET(srv[i],&fs);
+			if(srv[i]>m) m=srv[i];
+		}
+		if(select(m+1,&fs,0,0,0)<=0) continue;
+		for(i=0;i<ScpiCnt;i++){
+			if(!FD_ISSET(srv[i],&fs)) continue;
+			fd=accept(srv[i],0,0);
+			if(fd<0) continue;
+			if(ScpiConns>=ScpiMax) {close(fd); continue;}
+			__atomic_add_fetch(&ScpiConns,1,__ATOMIC_SEQ_CST);
+			if(xTaskCreatePinnedToCore(ScpiConn,"scpi",4096,(void *)(intptr_t)(fd<<8|(ScpiAddr+i)),2,0,0)!=pdPASS){
+				close(fd);
+				__atomic_sub_fetch(&ScpiConns,1,__ATOMIC_SEQ_CST);
+			}
+		}
+	}
+}
+
+
+static volatile int HisConns=0;
+
+//Task runs one HiSLIP connection; arg is the socket.
+static void HisConn(void *arg){
+	int fd=(intptr_t)arg;
+	HisRun(fd,HisAddr);
+	close(fd);
+	__atomic_sub_fetch(&HisConns,1,__ATOMIC_SEQ_CST);
+	vTaskDelete(NULL);
+}
+
+//Task accepts HiSLIP connections.
+static void HisTask(void *arg){
+	int srv, fd;
+	HisInit();
+	while((srv=TcpListen(HisPort))<0) vTaskDelay(1000);
+	for(;;){
+		fd=accept(srv,0,0);
+		if(fd<0) continue;
+		if(HisConns>=HisConnMax) {close(fd); continue;}
+		__atomic_add_fetch(&HisConns,1,__ATOMIC_SEQ_CST);
+		if(xTaskCreatePinnedToCore(HisConn,"hislip",4096,(void *)(intptr_t)fd,2,0,0)!=pdPASS){
+			close(fd);
+			__atomic_sub_fetch(&HisConns,1,__ATOMIC_SEQ_CST);
+		}
+	}
+}
+
+
+//Task runs UDP streaming.
+static void UdpTask(void *arg){
+	UdpRun(UdpPort);
+}
+
+
+static void HttpMetrics(void){
+	static char m[MetLen];				// HttpTask only
+	int n;
+	n=GpMetrics(m,sizeof(m));
+	n+=LnkMetrics(m+n,sizeof(m)-n);
+	UdpMetrics(m+n,sizeof(m)-n);
+	Http.send(200,"text/plain; version=0.0.4",m);
+}
+
+//Task serves HTTP requests.
+static void HttpTask(void *arg){
+	Http.on("/metrics",HttpMetrics);
+	Http.begin();
+	for(;;){
+		Http.handleClient();
+		vTaskDelay(2);
+	}
+}
+
+
+void setup(){
+	GpBegin();
+	xTaskCreatePinnedToCore(UartTask,"uart",8192,0,2,0,0);
+	if(WifiSsid[0]){
+		WiFi.mode(WIFI_STA);
+		WiFi.begin(WifiSsid,WifiPass);
+		xTaskCreatePinnedToCore(TcpTask,"tcp",8192,0,2,0,0);
+		xTaskCreatePinnedToCore(ScpiTask,"scpisrv",4096,0,2,0,0);
+		xTaskCreatePinnedToCore(HisTask,"hissrv",4096,0,2,0,0);
+		xTaskCreatePinnedToCore(UdpTask,"udp",6144,0,2,0,0);
+		xTaskCreatePinnedToCore(HttpTask,"http",6144,0,1,0,0);
+	}
+}
+
+
+void loop(){
+	vTaskDelete(NULL);				// Core 1 is left to GpTask
+}
@@ -0,0 +1,722 @@
+/*
+BSC protocol session of WGPIB firmware.
+Commands of BSC.C V2.5 (see its header for syntax and returns) are received from a
+host link and executed as operations of the GPIB engine. Supported commands:
+	IB<CR>, IBC, IBc, IB<DLE><STX>, IB?, IBB, IBZ, IBO, IBe, IBt, IBT, IBf, IBm,
+	IBS, IBQ, IBU?, IBI, IBP
+Other commands return <NAK>. Timeouts keep the units of BSC.C (32.768 ms).
+REN is a setting of the controller shared by all sessions; timeouts, Write Mode
+and SRQ interrupt are kept per session, IBt of one does not change the others.
+As other sessions would lose the addressing and remote state of their devices,
+IBO powers the bus off and IBm is accepted only while no other session which has
+used the bus is open (GpSesAlone); else IBO resets the state of the session only
+and IBm returns <NAK>.
+
+Store-and-forward read, for large transfers over a slow link (letters are not used
+by BSC.C, where IBs and IBg are other commands):
+	IBM			Reads data as IB? to the store of the adapter at bus speed; returns
+				length (4 bytes, LSB first) and result byte. ESC stops the read.
+				Read ends also when the store is full (see IBP), without EOI;
+				the next IBM continues it. Other sessions may use the bus in between,
+				so IBM first sends the bus commands since the last UNL again (up to 8)
+				to address the talker; with more of them IBC has to be sent again.
+	IBG<o>,<n>	Returns n bytes (0: to the end) at offset o of the last IBM as
+				<DLE><STX> ... <DLE><ETX> and ACK. <NAK> if the range is wrong or
+				the store was taken by IBM of another session, also after a part
+				of the data; the data before it is valid and IBG can continue there.
+IBG does not hold the bus, other sessions run their commands meanwhile.
+
+Framing of data blocks, for binary transfers (link.h):
+	IBF<n>		0: <DLE><STX> ... <DLE><ETX> with DLE doubled (BSC.C, default);
+				1: COBS frames, the block ends with a frame with LfLast.
+				Applies to IB<DLE><STX> (data is then sent as frames), IB?, IBG and IBP.
+				A frame from the host with LfSync is answered with ACK, as <DLE><ACK>.
+				After a wrong frame the data is dropped up to a frame with LfLast and
+				<NAK> is returned; a host without reply sends an empty frame with LfLast.
+
+Compression of data blocks to the host (lz.h), for slow links:
+	IBL<n>		0: off (default); 1: the data of IB?, IBG and IBP blocks is sent
+				in chunks of up to LzBlk bytes, each as raw length and packed
+				length (2 bytes each, LSB first) and the LZ block; packed length 0
+				means the raw bytes follow. A chunk which does not shrink by 1/8 is
+				sent raw; after LzBad of them in a row the next LzProbe chunks are
+				not tried. A chunk is sent after LzAge even if it is not full.
+				Framing (IBF) applies to the chunks. <NAK> if there is no memory.
+
+UART rate (link.h), UART link only (IBb is the benchmark of BSC.C):
+	IBu?		Returns the rate, 4 bytes LSB first.
+	IBu<n>		Sets the rate to n (LnkBaudMin ... LnkBaudMax): ACK is sent at the old
+				rate, then the host sends the next command at the new one within
+				BaudTmo; else the old rate is set again.
+
+Share of the bus (scheduler of gpib.h; IBq is not used by BSC.C):
+	IBq<w>		Sets the weight of the session, 1-255 (default 1). Sessions of one
+				class which wait for the bus get bus time in proportion to their
+				weights, e.g. a logger with 1 beside a control loop with 3.
+	IBq?		Returns the weight, 1 byte.
+
+Only commands which run operations of the engine (IB<CR>, IBS, IB<DLE><STX>, IB?,
+IBM, IBB, IBC, IBc, IBO, IBm, IBZ) take the bus; the others, as IBu waiting for the
+host at the new rate, do not stall other sessions.
+An addressed transaction is not interleaved with commands of other sessions: after
+IBC/IBc the session keeps the bus up to the end of the next command which takes it
+and is not IBC/IBc, or until it is idle for BscHold. Long reads (IB?, IBM) give the bus to
+waiting sessions of other devices between parts of GpChunk bytes and then send the
+bus commands since the last UNL (up to 8) again, to address the talker. The devices
+of a session are those addressed by these commands; all, if there are more of them,
+none are addressed or a universal command (DCL, LLO, ...) is among them.
+*/
+
+#include <Arduino.h>
+#include "gpib.h"
+#include "lz.h"
+#include "udp.h"
+#include "bsc.h"
+
+#define InstrMax 20			// Maximum length of command (incl. CR), 10 in BSC.C; IBG is longer
+#define WrPart 1024			// Write data is put to the engine in parts of this size
+#define TUnit 32768			// Timeout unit of BSC.C, us
+#define BscHold 200			// Bus is kept after IBC/IBc for up to this time, ms
+#define AdrMax 8			// Bus commands kept for addressing again
+#define BaudTmo 2000		// Host confirms a new UART rate within this time, ms
+#define LzBad 4				// Chunks which do not shrink before compression pauses
+#define LzProbe 32			// Chunks sent raw before it is tried again
+#define LzAge 20			// Partial chunk is sent after this time, ms
+
+static const char StrIDN0[]="WGPIB GPIB Controller\r\n";
+static const char StrIDN1[]="ESP32, based on USB GPIB Controller of B.G., LSD, FE, Slovenia\r\n";
+static const char StrIDN2[]="HW Rev.0, July 2018, FW V1.0.0, October 2026\r\n";
+
+// Compression state (IBL1), allocated while it is on
+typedef struct{
+	uint16_t n;				// Bytes in in
+	uint8_t bad;			// Chunks in a row which did not shrink
+	uint8_t skip;			// Chunks left which are sent raw
+	uint32_t t;				// Time of the first byte in in, ms
+	uint16_t h[1<<LzBits];
+	uint8_t in[LzBlk], out[LzBlk];
+} BscZ;
+
+typedef struct{
+	Link *l;
+	int pend;				// Byte received during read, begins the next command (PCByteRdy); -1: none
+	uint8_t WMode;			// GPIB write mode; 0-3 send EOI, 4-7 do not send EOI
+	uint8_t SRQen;			// SRQ interrupt enable
+	uint8_t Frm;			// Framing of data blocks: 0 DLE, 1 COBS (IBF)
+	BscZ *z;				// Compression (IBL); 0: off
+	uint32_t SrqSeen;		// SrqCnt reported with ENQ
+	uint32_t StId, StLen;	// Last stored read (GpStore) and its length
+	uint8_t StCont;			// It ended without EOI, the next one continues it
+	GpSes ses;
+	uint8_t held;			// Bus is kept after IBC/IBc
+	uint32_t th;			// Time of the last command, ms
+	uint8_t adr[AdrMax];	// Bus commands since UNL
+	uint8_t nadr;			// Their number; AdrMax+1: too many, a read does not give the bus away
+	uint8_t str[InstrMax+1];	// Received command, excluding IB header
+} Bsc;
+
+
+//Routine sends ENQ if SRQ was newly asserted and the interrupt is enabled.
+static void SrqSvc(Bsc *s){
+	uint32_t c=SrqCnt;
+	if(c==s->SrqSeen) return;
+	s->SrqSeen=c;
+	if(s->SRQen){
+		LnkPut(s->l,ENQ);
+		LnkFlush(s->l);
+	}
+}
+
+
+/*
+Routine returns the next byte from the host or LnkEnd. It waits as long as needed;
+if idle is set SRQ is serviced meanwhile.
+*/
+static int BscGet(Bsc *s, uint8_t idle){
+	int c;
+	if(s->pend>=0){
+		c=s->pend;
+		s->pend=-1;
+		return c;
+	}
+	for(;;){
+		c=LnkGet(s->l,10);
+		if(c!=LnkTmo) return c;
+		if(idle) SrqSvc(s);
+		if(idle && s->held && millis()-s->th>=BscHold){
+			GpUnlock(&s->ses);
+			s->held=0;
+		}
+	}
+}
+
+
+//Routine sends the bus commands since the last UNL again, to address the talker. Returns result byte.
+static uint8_t BscAddr(Bsc *s){
+	GpEv e;
+	GpData(s->adr,s->nadr);
+	return GpDo(GoCmd,GfRel,0,s->nadr,&e);
+}
+
+//Routine adds the device addressed by bus command b to the devices m of the session.
+static uint32_t BscBit(uint32_t m, uint8_t b){
+	b&=0x7f;
+	if(b==0x3f || b==0x5f || b>=0x60) return m;	// UNL, UNT, secondary address
+	if(b>=0x20) return b&0x1f ? m|GpDev(b&0x1f) : m;	// LAD, TAD; address 0 is the controller
+	return b>=0x10 ? GpDevAll : m;				// Universal or addressed command
+}
+
+//Routine returns 1 if command c runs operations of the engine and so needs the bus.
+static uint8_t BscBus(uint8_t c){
+	switch(c){
+	case '\r':
+	case 'S':
+	case DLE:
+	case '?':
+	case 'M':
+	case 'B':
+	case 'C':
+	case 'c':
+	case 'O':
+	case 'm':
+	case 'Z':
+		return 1;
+	}
+	return 0;
+}
+
+/*
+Routine sets the devices of the session (GpSes.dev) for command c, before it runs.
+Commands of the controller and the lines use no device.
+*/
+static void BscDev(Bsc *s, const uint8_t *c){
+	uint32_t m=0;
+	uint8_t i, k=s->nadr;
+	switch(c[0]){
+	case 'C':
+	case 'c':
+		if(c[1]==0x3f) k=0;						// UNL
+		else if(k>=AdrMax) k=AdrMax+1;
+		else m=BscBit(0,c[1]);
+		/* fall through */
+	case DLE:
+	case '?':
+	case 'M':
+	case 'B':
+		if(k>AdrMax || (!k && !m && c[0]!='C' && c[0]!='c')) {s->ses.dev=GpDevAll; return;}
+		for(i=0;i<k;i++) m=BscBit(m,s->adr[i]);
+		s->ses.dev=m;
+		return;
+	case 'O':
+	case 'm':
+	case 'Z':
+		s->ses.dev=GpDevAll;
+		return;
+	}
+	s->ses.dev=0;
+}
+
+/*
+Routine gives the bus to waiting sessions between parts of a long read, if the
+talker can be addressed again. Returns 0 if it could not.
+*/
+static uint8_t BscYield(Bsc *s){
+	if(!s->nadr || s->nadr>AdrMax) return 1;
+	if(!GpYield(&s->ses,GcBulk)) return 1;
+	return BscAddr(s)==ACK;
+}
+
+
+//Routine sends n bytes at p within a data block in the framing of the session.
+static void BscOut(Bsc *s, const uint8_t *p, uint32_t n){
+	uint32_t i;
+	if(s->Frm) {LnkFrmWrite(s->l,p,n); return;}
+	for(i=0;i<n;i++){
+		LnkPut(s->l,p[i]);
+		if(p[i]==DLE) LnkPut(s->l,DLE);
+	}
+}
+
+//Routine sends collected chunk, compressed if it shrinks enough.
+static void BscZOut(Bsc *s){
+	BscZ *z=s->z;
+	uint8_t hd[4];
+	uint32_t k=0;
+	if(z->skip) z->skip--;
+	else{
+		k=LzPack(z->h,z->in,z->n,z->out,z->n-z->n/8);
+		if(k) z->bad=0;
+		else if(++z->bad>=LzBad){		// Data does not compress, do not spend time on it
+			z->bad=0;
+			z->skip=LzProbe;
+		}
+	}
+	hd[0]=z->n; hd[1]=z->n>>8;
+	hd[2]=k; hd[3]=k>>8;
+	BscOut(s,hd,4);
+	BscOut(s,k ? z->out : z->in,k ? k : z->n);
+	z->n=0;
+}
+
+
+//Routines send data block to the host: begin, n bytes at p, end.
+static void BscBlkBeg(Bsc *s){
+	if(!s->Frm) {LnkPut(s->l,DLE); LnkPut(s->l,STX);}
+}
+
+static void BscBlk(Bsc *s, const uint8_t *p, uint32_t n){
+	BscZ *z=s->z;
+	uint32_t k;
+	if(!z) {BscOut(s,p,n); return;}
+	while(n){
+		if(!z->n) z->t=millis();
+		k=LzBlk-z->n;
+		if(k>n) k=n;
+		memcpy(z->in+z->n,p,k);
+		z->n+=k;
+		p+=k; n-=k;
+		if(z->n==LzBlk) BscZOut(s);
+	}
+}
+
+//Routine sends partial chunk after LzAge, so slow data is not held back.
+static void BscBlkIdle(Bsc *s){
+	if(s->z && s->z->n && millis()-s->z->t>=LzAge) BscZOut(s);
+}
+
+static void BscBlkEnd(Bsc *s){
+	if(s->z && s->z->n) BscZOut(s);
+	if(s->Frm) LnkFrmEnd(s->l,LfLast);
+	else {LnkPut(s->l,DLE); LnkPut(s->l,ETX);}
+}
+
+
+/*
+Routine forwards data block from the host to the bus, as WriteData.
+Bytes are put to the engine in parts; the last byte is held back until <DLE><ETX>
+shows whether it is the last one (with EOI). After an error (also DLE followed by
+other byte than DLE, ETX or ACK) the rest of the block is received and dropped.
+Returns result byte, 0 if the link was closed.
+*/
+static uint8_t BscWrite(Bsc *s, uint8_t eoi){
+	uint8_t buf[WrPart], res=0;
+	uint32_t k=0;
+	int c, h=-1;
+	GpOp o={GoWrite,GfNew,0,0,0};
+	GpEv e;
+	for(;;){
+		c=BscGet(s,0);
+		if(c==LnkEnd) break;
+		if(c==DLE){
+			c=BscGet(s,0);
+			if(c==ETX) break;
+			if(c==LnkEnd) break;
+			if(c==ACK){						// Sync: data before it is on the bus
+				if(!res && k){
+					GpData(buf,k); o.n=k; GpPut(&o);
+					o.flg=0; k=0;
+				}
+				while(!res && RingUsed(&GpWrR)) if(GpGet(&e,1)) res=e.res;
+				LnkPut(s->l,ACK);
+				LnkFlush(s->l);
+				continue;
+			}
+			if(c!=DLE){						// Format error; rest is dropped up to <DLE><ETX> as XmtBlkBrk of BSC.C
+				GpErr(DataFrmtErr);
+				eoi=0;						// Held byte is sent without EOI
+				if(!res) res=NAK;
+				continue;
+			}
+		}
+		if(res) continue;					// Drain after error
+		if(h>=0){
+			buf[k++]=h;
+			if(k==WrPart){
+				GpData(buf,k); o.n=k; GpPut(&o);
+				o.flg=0; k=0;
+				if(GpGet(&e,0)) res=e.res;	// Failed part
+			}
+		}
+		h=c;
+	}
+	if(res && res!=NAK) return c==LnkEnd ? 0 : res;
+	if(h>=0) buf[k++]=h;
+	GpData(buf,k); o.n=k;
+	o.flg|=GfEnd|(eoi&&c==ETX ? GfEOI : 0);
+	GpPut(&o);
+	while(!GpGet(&e,1000));
+	if(c==LnkEnd) return 0;
+	return e.res!=ACK ? e.res : res ? res : ACK;
+}
+
+
+/*
+Routine forwards data block in COBS frames from the host to the bus, as BscWrite.
+Returns result byte, 0 if the link was closed.
+*/
+static uint8_t BscWriteFrm(Bsc *s, uint8_t eoi){
+	uint8_t buf[LnkFrm+5], flg=0, res=0, b;
+	uint32_t k;
+	int n, h=-1;
+	GpOp o={GoWrite,GfNew,0,0,0};
+	GpEv e;
+	for(;;){
+		n=LnkFrmRead(s->l,buf,&flg);
+		if(n==LnkEnd) break;
+		if(n==LnkBad){						// Held byte is sent without EOI
+			res=res ? res : NAK;
+			continue;
+		}
+		if(!res && n){
+			k=0;
+			if(h>=0) {b=h; GpData(&b,1); k=1;}
+			GpData(buf,n-1);
+			k+=n-1;
+			h=buf[n-1];
+			if(k){
+				o.n=k; GpPut(&o);
+				o.flg=0;
+				if(GpGet(&e,0)) res=e.res;	// Failed part
+			}
+		}
+		if(flg&LfLast) break;
+		if(flg&LfSync){						// Data before it is on the bus
+			while(!res && RingUsed(&GpWrR)) if(GpGet(&e,1)) res=e.res;
+			LnkPut(s->l,ACK);
+			LnkFlush(s->l);
+		}
+	}
+	if(res && res!=NAK) return n==LnkEnd ? 0 : res;
+	k=0;
+	if(h>=0) {b=h; GpData(&b,1); k=1;}
+	o.n=k;
+	o.flg|=GfEnd|(eoi && !res && n!=LnkEnd ? GfEOI : 0);
+	GpPut(&o);
+	while(!GpGet(&e,1000));
+	if(n==LnkEnd) return 0;
+	return e.res!=ACK ? e.res : res ? res : ACK;
+}
+
+
+//Routine stops the read in progress on ESC from the host; other byte is kept for the next command.
+static void BscEsc(Bsc *s, uint8_t *stop){
+	GpOp st={GoStop,0,0,0,0};
+	int c;
+	if(*stop || s->pend>=0 || !LnkAvail(s->l)) return;
+	c=LnkGet(s->l,0);
+	if(c==ESC){
+		GpPut(&st);
+		*stop=1;
+	}
+	else if(c>=0) s->pend=c;
+}
+
+
+/*
+Routine reads data from the bus and sends it to the host as <DLE><STX> ... <DLE><ETX>
+or in frames. ESC from the host stops the read. Returns result byte.
+*/
+static uint8_t BscRead(Bsc *s){
+	GpOp o={GoRead,RdEOI,0,0,s->nadr && s->nadr<=AdrMax ? (uint32_t)GpChunk : 0};
+	GpEv e;
+	uint8_t *p, ev, stop=0;
+	uint32_t n;
+	BscBlkBeg(s);
+	do{
+		GpPut(&o);
+		for(;;){
+			ev=GpGet(&e,0);
+			while((n=RingRdSpan(&GpRdR,&p))){	// Data before the event is in the ring
+				BscBlk(s,p,n);
+				RingSkip(&GpRdR,n);
+			}
+			if(ev) break;
+			BscEsc(s,&stop);
+			BscBlkIdle(s);
+			LnkFlush(s->l);
+			GpWait(1);
+		}
+	}while(e.res==ACK && !e.eoi && !stop && e.n==o.n && BscYield(s));
+	BscBlkEnd(s);
+	return e.res;
+}
+
+
+/*
+Routine reads data from the bus to the store and sends its length (IBM). If the last
+one ended without EOI the talker is addressed again first. Returns result byte.
+*/
+static uint8_t BscStore(Bsc *s){
+	GpOp o={GoRead,RdEOI|RdStore,0,0,s->nadr && s->nadr<=AdrMax ? (uint32_t)GpChunk : 0};
+	GpEv e;
+	uint8_t stop=0;
+	s->StId=GpStore();
+	s->StLen=0;
+	if(s->StCont && s->nadr && s->nadr<=AdrMax && (e.res=BscAddr(s))!=ACK){
+		LnkWrite(s->l,(uint8_t *)&s->StLen,4);
+		return e.res;
+	}
+	do{
+		GpPut(&o);
+		while(!GpGet(&e,10)) BscEsc(s,&stop);
+		s->StLen+=e.n;
+		o.flg|=RdMore;
+	}while(e.res==ACK && !e.eoi && !stop && e.n==o.n && BscYield(s)
+		&& GpFetch(s->StId,0,0,0));		// Store was not taken meanwhile
+	s->StCont=e.res==ACK && !e.eoi && !stop;
+	LnkWrite(s->l,(uint8_t *)&s->StLen,4);
+	return e.res;
+}
+
+
+//Routine sends range of the last stored read (IBG<o>,<n>). Returns result byte.
+static uint8_t BscFetch(Bsc *s){
+	uint8_t buf[512];
+	char *c=(char *)s->str+1;
+	uint32_t o, n, k;
+	o=strtoul(c,&c,10);
+	if(*c!=',') return NAK;
+	n=strtoul(c+1,&c,10);
+	if(*c!='\r' || o>s->StLen) return NAK;
+	if(!n || n>s->StLen-o) n=s->StLen-o;
+	if(!GpFetch(s->StId,0,buf,0)) return NAK;
+	BscBlkBeg(s);
+	while(n){
+		k=n<sizeof(buf) ? n : sizeof(buf);
+		if(!GpFetch(s->StId,o,buf,k)) break;	// Taken by another session
+		BscBlk(s,buf,k);
+		o+=k; n-=k;
+	}
+	BscBlkEnd(s);
+	return n ? NAK : ACK;
+}
+
+
+//Routine reads one byte from the bus and sends it to the host (NUL on error). Returns result byte.
+static uint8_t BscRdByte(Bsc *s){
+	GpEv e;
+	GpDo(GoRdByte,0,0,0,&e);
+	while(RingUsed(&GpRdR)) LnkPut(s->l,RingGet(&GpRdR));
+	return e.res;
+}
+
+
+//Routine sets timeout t (TmByte ...) to v in units of BSC.C.
+static void BscTmo(Bsc *s, uint8_t t, uint32_t v){
+	GpTmo(&s->ses,t,v*TUnit);
+}
+
+
+/*
+Routine sets UART rate b; it is kept if the host sends the next command ("IB...")
+at that rate. Returns result byte; ACK is sent already.
+*/
+static uint8_t BscBaud(Bsc *s, uint32_t b){
+	uint32_t old=LnkBaudGet();
+	int c;
+	LnkPut(s->l,ACK);
+	LnkFlush(s->l);
+	LnkBaud(b);
+	c=LnkGet(s->l,BaudTmo);
+	if(c=='I'){
+		s->pend=c;
+		return 0;
+	}
+	LnkBaud(old);					// Nothing or garbage came
+	return 0;
+}
+
+
+static void BscPutStr(Bsc *s, const char *p){
+	LnkWrite(s->l,(const uint8_t *)p,strlen(p));
+}
+
+
+/*
+Command dispatcher; executes command in s->str. n is the length of the command,
+n>=InstrMax means the command was too long. Returns result byte to be sent, 0 if none.
+*/
+static uint8_t BscExec(Bsc *s, uint8_t n){
+	uint8_t *c=s->str, i;
+	uint32_t t;
+	GpOp o={GoOff,0,0,0,0};
+	GpEv e;
+	char *m;
+	int k;
+
+	if(n>=InstrMax) return NAK;		// Check that command is not too long
+
+	switch(c[0]){
+	case 'O':						// Power OFF; with other sessions only the state of this one is reset
+		if(GpSesAlone(&s->ses)) GpPut(&o);
+		GpTmo(&s->ses,TmByte,TMax_def);
+		GpTmo(&s->ses,TmTot,TMaxTot_def);
+		GpTmo(&s->ses,TmFirst,TMaxFirst_def);
+		s->WMode=0;
+		s->SRQen=0;
+		s->Frm=0;
+		free(s->z);
+		s->z=0;
+		return 0;
+	case 't':						// Byte timeout
+		BscTmo(s,TmByte,atoi((char *)c+1));
+		return ACK;
+	case 'T':						// Total timeout
+		BscTmo(s,TmTot,atoi((char *)c+1));
+		return ACK;
+	case 'f':						// Timeout for the first byte
+		BscTmo(s,TmFirst,atoi((char *)c+1));
+		return ACK;
+	case 'e':						// Write mode
+		i=atoi((char *)c+1);
+		if(i>7) return NAK;
+		s->WMode=i;
+		return ACK;
+	case 'F':						// Framing of data blocks
+		if(c[1]!='0' && c[1]!='1') return NAK;
+		s->Frm=c[1]-'0';
+		return ACK;
+	case 'L':						// Compression of data blocks
+		if(c[1]!='0' && c[1]!='1') return NAK;
+		if(c[1]=='0') {free(s->z); s->z=0; return ACK;}
+		if(!s->z && !(s->z=(BscZ *)malloc(sizeof(BscZ)))) return NAK;
+		s->z->n=0;
+		s->z->bad=0;
+		s->z->skip=0;
+		return ACK;
+	case 'u':						// UART rate
+		if(s->l->fd!=LnkUart) return NAK;
+		if(c[1]=='?'){
+			t=LnkBaudGet();
+			LnkWrite(s->l,(uint8_t *)&t,4);
+			return 0;
+		}
+		t=strtoul((char *)c+1,0,10);
+		if(t<LnkBaudMin || t>LnkBaudMax) return NAK;
+		return BscBaud(s,t);
+	case 'm':						// REN state
+		if((c[1]!='0' && c[1]!='1') || !GpSesAlone(&s->ses)) return NAK;
+		o.op=GoRen;
+		o.arg=c[1]=='1';
+		GpPut(&o);
+		return ACK;
+	case 'q':						// Weight of the session
+		if(c[1]=='?'){
+			LnkPut(s->l,s->ses.w);
+			return 0;
+		}
+		k=atoi((char *)c+1);
+		if(k<1 || k>255) return NAK;
+		s->ses.w=k;
+		return ACK;
+	case 'Q':						// SRQ interrupt
+		if(c[1]!='0' && c[1]!='1') return NAK;
+		s->SRQen=c[1]=='1';
+		s->SrqSeen=SrqCnt-(s->SRQen && SrqLine);	// ENQ also if SRQ is asserted now
+		return ACK;
+	case 'U':						// Time of the adapter clock
+		if(c[1]!='?') return NAK;
+		t=Micros();
+		LnkWrite(s->l,(uint8_t *)&t,4);
+		return 0;
+	case 'I':						// Identification string
+		if(c[1]=='0') BscPutStr(s,StrIDN0);
+		else if(c[1]=='1') BscPutStr(s,StrIDN1);
+		else if(c[1]=='2') BscPutStr(s,StrIDN2);
+		return 0;
+	case 'P':						// Performance counters
+		if(!(m=(char *)malloc(MetLen))) return NAK;
+		k=GpMetrics(m,MetLen);
+		k+=LnkMetrics(m+k,MetLen-k);
+		k+=UdpMetrics(m+k,MetLen-k);
+		BscBlkBeg(s);
+		BscBlk(s,(uint8_t *)m,k);
+		BscBlkEnd(s);
+		free(m);
+		return ACK;
+	case '\r':						// Null command (power on and return ACK)
+		return GpDo(GoNop,0,0,0,&e);
+	case 'S':						// State of control lines
+		GpDo(GoStat,0,0,0,&e);
+		LnkPut(s->l,e.stat);
+		return 0;
+	case DLE:						// Send data
+		if(c[1]==STX) return s->Frm ? BscWriteFrm(s,s->WMode<4) : BscWrite(s,s->WMode<4);
+		break;
+	case '?':						// Read data
+		return BscRead(s);
+	case 'M':						// Read data to the store
+		return BscStore(s);
+	case 'B':						// Read one byte from the bus
+		return BscRdByte(s);
+	case 'C':						// Send bus command
+	case 'c':
+		if(c[1]==0x3f) s->nadr=0;	// UNL
+		if(s->nadr<AdrMax) s->adr[s->nadr]=c[1];
+		if(s->nadr<=AdrMax) s->nadr++;
+		GpData(c+1,1);
+		return GpDo(GoCmd,c[0]=='C' ? GfRel : 0,0,1,&e);
+	case 'Z':						// Interface Clear
+		return GpDo(GoIFC,0,0,0,&e);
+	}
+	return NAK;						// The command was not recognised
+}
+
+
+/*
+Routine runs BSC protocol on link l until it is closed.
+Commands are received as in the main loop of BSC.C: bytes are skipped up to "IB",
+then the command is received up to CR (or STX of a data block).
+*/
+void BscRun(Link *l){
+	Bsc s;
+	int c;
+	uint8_t i=0, r;
+	memset(&s,0,sizeof(s));
+	s.l=l;
+	s.pend=-1;
+	s.SrqSeen=SrqCnt;
+	GpSesInit(&s.ses,1);
+	for(;;){
+		c=BscGet(&s,1);				// Wait for "IB"
+		if(c==LnkEnd) break;
+		switch(i){
+			case 0:
+				if(c=='I') i++;
+				else if(c!='\r' && c!='\n' && c!=ETX && c!=ESC) i=2;
+				continue;
+			case 1:
+				if(c=='B') break;
+				i=(c=='\r' || c=='\n' || c==ETX) ? 0 : 2;
+				continue;
+			default:
+				if(c=='\r' || c=='\n' || c==ETX) i=0;	// Wait for CR (or LF) after errored beginning
+				continue;
+		}
+		for(i=0;i<InstrMax;){		// Receive command w/o IB
+			c=BscGet(&s,0);
+			if(c==LnkEnd) break;
+			if(c=='\n') c='\r';
+			s.str[i]=c;
+			if((c=='\r' || c==STX) && (i!=1 || (s.str[0]!='c' && s.str[0]!='C'))) break;
+			i++;
+		}
+		if(c==LnkEnd) break;
+		if(i<InstrMax) s.str[i+1]=0;
+		c=s.str[0];
+		if(i>=InstrMax || !BscBus(c)) r=i<InstrMax && c=='G' ? BscFetch(&s) : BscExec(&s,i);	// Does not use the bus
+		else{
+			BscDev(&s,s.str);
+			if(!s.held) GpLock(&s.ses,c=='B' || ((c=='C' || c=='c') && (s.str[1]==0x18 || s.str[1]==0x19)) ? GcSrq : GcQuery);
+			r=BscExec(&s,i);
+			s.held=c=='C' || c=='c';	// Addressed transaction goes on
+			s.th=millis();
+			if(!s.held) GpUnlock(&s.ses);
+		}
+		if(r) LnkPut(l,r);
+		i=0;
+	}
+	if(s.held) GpUnlock(&s.ses);
+	GpSesEnd(&s.ses);
+	free(s.z);
+}
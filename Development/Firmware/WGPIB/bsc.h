@@ -0,0 +1,12 @@
+/*
+BSC protocol session of WGPIB firmware.
+*/
+
+#ifndef BSC_H
+#define BSC_H
+
+#include "link.h"
+
+void BscRun(Link *l);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+DIO and control line access of the GPIB engine; included by gpib.cpp only.
+ESP32 (unlike ESP32-S2/S3) has no dedicated GPIO bundles, so the lines are
+accessed through the GPIO W1TS/W1TC (write 1 to set/clear) registers with masks
+computed at compile time from the pin map in gpib.h:
+	DioWr	DIO byte with 4 stores (set and clear in both banks), tables DioSet0, DioSet1
+	DioGet	DIO byte from one read of each bank, bits are shifted by constants
+	CtlOut	any control lines driven low and released with one store each
+A read of GPIO_IN_REG samples all control lines and the DIO lines of bank 0 at once.
+Control lines have to be in bank 0 (GPIO 0-31); DIO lines can be in both banks.
+*/
+
+#ifndef DIO_H
+#define DIO_H
+
+#include "soc/gpio_reg.h"
+#include "gpib.h"
+
+#define DioFn static inline __attribute__((always_inline))
+
+// Mask of pin p in its register bank; 0 if it is in the other bank
+#define Bk0(p) ((p)<32 ? 1UL<<((p)&31) : 0UL)
+#define Bk1(p) ((p)<32 ? 0UL : 1UL<<((p)&31))
+#define Msk(p) (1UL<<(p))		// Control line
+
+static_assert(PinREN<32 && PinIFC<32 && PinNDAC<32 && PinNRFD<32 && PinDAV<32 && PinEOI<32
+	&& PinATN<32 && PinSRQ<32 && PinTE<32 && PinDC<32, "Control lines must be GPIO 0-31");
+
+#define DioMsk0 (Bk0(PinDIO1)|Bk0(PinDIO2)|Bk0(PinDIO3)|Bk0(PinDIO4)|Bk0(PinDIO5)|Bk0(PinDIO6)|Bk0(PinDIO7)|Bk0(PinDIO8))
+#define DioMsk1 (Bk1(PinDIO1)|Bk1(PinDIO2)|Bk1(PinDIO3)|Bk1(PinDIO4)|Bk1(PinDIO5)|Bk1(PinDIO6)|Bk1(PinDIO7)|Bk1(PinDIO8))
+
+// Bits of bank bk (Bk0, Bk1) set for DIO line state b
+#define DioS(bk,b) (((b)&0x01 ? bk(PinDIO1) : 0)|((b)&0x02 ? bk(PinDIO2) : 0)|((b)&0x04 ? bk(PinDIO3) : 0)|((b)&0x08 ? bk(PinDIO4) : 0) \
+	|((b)&0x10 ? bk(PinDIO5) : 0)|((b)&0x20 ? bk(PinDIO6) : 0)|((b)&0x40 ? bk(PinDIO7) : 0)|((b)&0x80 ? bk(PinDIO8) : 0))
+#define DioT4(bk,b) DioS(bk,b),DioS(bk,(b)+1),DioS(bk,(b)+2),DioS(bk,(b)+3)
+#define DioT16(bk,b) DioT4(bk,b),DioT4(bk,(b)+4),DioT4(bk,(b)+8),DioT4(bk,(b)+12)
+#define DioT64(bk,b) DioT16(bk,b),DioT16(bk,(b)+16),DioT16(bk,(b)+32),DioT16(bk,(b)+48)
+#define DioT256(bk) DioT64(bk,0),DioT64(bk,64),DioT64(bk,128),DioT64(bk,192)
+
+DRAM_ATTR static const uint32_t DioSet0[256]={DioT256(Bk0)};
+DRAM_ATTR static const uint8_t DioSet1[256]={DioT256(Bk1)};	// GPIO 32-39
+
+
+//Routine sets output pin p to v. GPIO 32-39 are in the second register bank.
+DioFn void PinSet(uint8_t p, uint8_t v){
+	if(p<32) REG_WRITE(v ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG,1UL<<p);
+	else REG_WRITE(v ? GPIO_OUT1_W1TS_REG : GPIO_OUT1_W1TC_REG,1UL<<(p-32));
+}
+
+DioFn uint8_t PinGet(uint8_t p){
+	if(p<32) return (REG_READ(GPIO_IN_REG)>>p)&1;
+	return (REG_READ(GPIO_IN1_REG)>>(p-32))&1;
+}
+
+//Routine enables (out=1) or disables output driver of pin p, as DDR bit.
+DioFn void PinDir(uint8_t p, uint8_t out){
+	if(p<32) REG_WRITE(out ? GPIO_ENABLE_W1TS_REG : GPIO_ENABLE_W1TC_REG,1UL<<p);
+	else REG_WRITE(out ? GPIO_ENABLE1_W1TS_REG : GPIO_ENABLE1_W1TC_REG,1UL<<(p-32));
+}
+
+// GPIB control lines
+#define SRQin PinGet(PinSRQ)
+#define ATNout(v) PinSet(PinATN,v)
+#define ATNin PinGet(PinATN)
+#define EOIout(v) PinSet(PinEOI,v)
+#define EOIin PinGet(PinEOI)
+#define DAVout(v) PinSet(PinDAV,v)
+#define DAVin PinGet(PinDAV)
+#define NRFDout(v) PinSet(PinNRFD,v)
+#define NRFDin PinGet(PinNRFD)
+#define NDACout(v) PinSet(PinNDAC,v)
+#define NDACin PinGet(PinNDAC)
+#define IFCout(v) PinSet(PinIFC,v)
+#define IFCin PinGet(PinIFC)
+#define RENout(v) PinSet(PinREN,v)
+#define RENin PinGet(PinREN)
+#define TE(v) PinSet(PinTE,v)
+#define DC(v) PinSet(PinDC,v)
+
+// Control lines in mask lo are driven low, then lines in hi are released (Msk of pins)
+#define CtlOut(lo,hi) {REG_WRITE(GPIO_OUT_W1TC_REG,lo); REG_WRITE(GPIO_OUT_W1TS_REG,hi);}
+// Control lines in mask m become outputs (out=1) or inputs
+#define CtlDir(m,out) REG_WRITE((out) ? GPIO_ENABLE_W1TS_REG : GPIO_ENABLE_W1TC_REG,m)
+// State of control line p in sample i of GPIO_IN_REG
+#define CtlBit(i,p) (((i)>>(p))&1)
+
+#define In0() REG_READ(GPIO_IN_REG)
+#define In1() (DioMsk1 ? REG_READ(GPIO_IN1_REG) : 0)
+
+
+//Routine puts b on DIO lines (PORTIB=b).
+DioFn void DioWr(uint8_t b){
+	uint32_t m=DioSet0[b];
+	REG_WRITE(GPIO_OUT_W1TS_REG,m);
+	REG_WRITE(GPIO_OUT_W1TC_REG,m^DioMsk0);
+	if(DioMsk1){
+		m=DioSet1[b];
+		REG_WRITE(GPIO_OUT1_W1TS_REG,m);
+		REG_WRITE(GPIO_OUT1_W1TC_REG,m^DioMsk1);
+	}
+}
+
+// Bit k of DIO byte from pin p in samples i0, i1 of both banks
+#define DioBit(p,k,i0,i1) (((((p)<32 ? (i0) : (i1))>>((p)&31))&1)<<(k))
+
+//Routine returns DIO line state from samples i0, i1 of GPIO_IN_REG and GPIO_IN1_REG.
+DioFn uint8_t DioGet(uint32_t i0, uint32_t i1){
+	return DioBit(PinDIO1,0,i0,i1)|DioBit(PinDIO2,1,i0,i1)|DioBit(PinDIO3,2,i0,i1)|DioBit(PinDIO4,3,i0,i1)
+		|DioBit(PinDIO5,4,i0,i1)|DioBit(PinDIO6,5,i0,i1)|DioBit(PinDIO7,6,i0,i1)|DioBit(PinDIO8,7,i0,i1);
+}
+
+//Routine returns state of DIO lines (PINIB).
+#define DioRd() DioGet(In0(),In1())
+
+DioFn void DioDir(uint8_t out){
+	REG_WRITE(out ? GPIO_ENABLE_W1TS_REG : GPIO_ENABLE_W1TC_REG,DioMsk0);
+	if(DioMsk1) REG_WRITE(out ? GPIO_ENABLE1_W1TS_REG : GPIO_ENABLE1_W1TC_REG,DioMsk1);
+}
+
+#endif
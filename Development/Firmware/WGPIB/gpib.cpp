@@ -0,0 +1,942 @@
+/*
+GPIB engine of WGPIB firmware, see gpib.h.
+Routines follow SetTalk, SendCmd, SendBinData, RcvBinData ... of BSC.C.
+Handshake loops are placed in IRAM (IRAM_ATTR), so they do not wait for flash
+cache misses; data they use is in DRAM. GpTask runs alone on core 1 and is not
+preempted by Wi-Fi; it sleeps on task notification while there is no operation.
+Bus lines are accessed through dio.h.
+*/
+
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "gpib.h"
+#include "dio.h"
+
+Ring GpOpR, GpWrR, GpRdR, GpEvR;
+static uint8_t OpBuf[OpRLen], WrBuf[WrRLen], RdBuf[RdRLen], EvBuf[EvRLen];
+
+static TaskHandle_t GpHnd=0;			// GpTask
+static TaskHandle_t GpHost=0;			// Host task which has the bus, woken by the engine
+static SemaphoreHandle_t GpMtx;			// Scheduler state
+
+volatile uint32_t XmtCnt=0, RcvCnt=0, CmdCnt=0, SrqCnt=0;
+volatile uint8_t SrqLine=0;
+static uint8_t *GpSt;					// Store of RdStore reads
+uint32_t GpStMax=0;
+static uint32_t GpStId=0;				// Stored read which owns the store, see GpStore
+static uint32_t StLen=0;				// Bytes in the store, RdMore continues there
+
+// Scheduler; GpMtx
+static GpSes *SesList=0;				// Registered sessions
+static GpSes *SesOwn=0;					// Session which has the bus
+static uint32_t SesV=0;					// Virtual time, start tag of the transaction running
+static uint32_t SesSeq=0;				// Grants
+static uint32_t SchWait[GcNum];			// Sessions waiting, per class
+static uint32_t SchGrant[GcNum];		// Transactions run
+static uint64_t SchWaitUs[GcNum];		// Time waited, us
+static uint32_t SchMaxUs[GcNum];		// Longest wait, us
+static uint32_t TmoOp[3]={TMax_def,TMaxTot_def,TMaxFirst_def};	// Timeouts put to the engine (GoTmo); lock holder
+static volatile uint32_t ErrCnt[DataFrmtErr];	// Failed operations per break cause (brk&0x0f)-1
+
+// Handshake wait histograms as OptHist of BSC.C; bin b counts waits below 4<<2b us
+#define PhNRFD 0
+#define PhNDAC 1
+#define PhDAV 2
+#define PhCmd 3				// NRFD and NDAC of bus commands
+#define PhNum 4
+#define HistBins 8
+static uint32_t Hist[PhNum][HistBins];
+static uint64_t PhTime[PhNum];			// Total wait time per phase, us
+
+static uint8_t brk=0;
+static uint8_t pwr=0;					// Lines are driven
+static uint8_t RenOn=1;					// REN is asserted at power on
+static uint8_t WrSkip=0;				// Rest of a failed message is discarded
+static volatile uint8_t StopReq=0;		// GpStop: read of the session which has the bus is stopped
+
+// Timeouts in us, 0: disabled; set by GoTmo from the session which has the bus
+static uint32_t TMax=TMax_def, TMaxTot=TMaxTot_def, TMaxFirst=TMaxFirst_def;
+static uint32_t TLim;					// Current byte timeout, TMaxFirst before the first byte
+static uint32_t TByte, TTot;			// Start of byte and total timeout
+
+uint32_t IRAM_ATTR Micros(void){
+	return (uint32_t)esp_timer_get_time();
+}
+
+
+//Routine returns control lines as IBS (PINIBctrl).
+static uint8_t CtlRd(void){
+	uint32_t i=In0();
+	return CtlBit(i,PinSRQ)<<7|CtlBit(i,PinATN)<<6|CtlBit(i,PinEOI)<<5|CtlBit(i,PinDAV)<<4
+		|CtlBit(i,PinNRFD)<<3|CtlBit(i,PinNDAC)<<2|CtlBit(i,PinIFC)<<1|CtlBit(i,PinREN);
+}
+
+
+//Routine restarts byte timeout.
+#define TimRst() TByte=Micros()
+
+//Routine sets brk on timeout. Returns brk.
+static inline __attribute__((always_inline)) uint8_t TmoChk(void){
+	uint32_t t=Micros();
+	if(TLim && t-TByte>=TLim) brk|=TimOutBrk;
+	if(TMaxTot && t-TTot>=TMaxTot) brk|=TimOutBrk;
+	return brk;
+}
+
+// Records change of SRQ line. It is checked while idle and during handshake waits.
+#define SrqChk() if((!SRQin)!=SrqLine) SrqEdge()
+
+//Routine adds wait of phase ph which started at t0 to its histogram.
+static inline __attribute__((always_inline)) void HistAdd(uint8_t ph, uint32_t t0){
+	uint32_t d=Micros()-t0;
+	uint8_t b;
+	PhTime[ph]+=d;
+	for(b=0;d>=4 && b<HistBins-1;b++) d>>=2;
+	Hist[ph][b]++;
+}
+
+/*
+Waits while cond; on timeout brk is ORed with err and the routine continues at Ret.
+A wait is timed for the histogram of phase ph only if cond holds at the start,
+so the fast path does not read the timer.
+*/
+#define HsWait(cond,err,ph) if(cond){uint32_t t0=Micros(); \
+	while(cond) {SrqChk(); if(TmoChk()) {brk|=err; HistAdd(ph,t0); goto Ret;}} HistAdd(ph,t0);}
+
+
+static void IRAM_ATTR SrqEdge(void){
+	SrqLine=!SRQin;
+	if(SrqLine) SrqCnt++;
+}
+
+//Routine wakes the host task waiting in GpGet or GpWait.
+static void HostWake(void){
+	if(GpHost) xTaskNotifyGive(GpHost);
+}
+
+//Routine sends event e to the host. It is dropped if the host does not take events.
+static void EvPut(GpEv *e){
+	if(RingFree(&GpEvR)>=sizeof(GpEv)) RingWrite(&GpEvR,e,sizeof(GpEv));
+	HostWake();
+}
+
+/*
+Returns 1 if the next operation is GoStop and removes it, or GpStop was called.
+Other operations wait. Used by reads while waiting, as ChkEsc.
+*/
+static inline __attribute__((always_inline)) uint8_t StopChk(void){
+	if(StopReq) {StopReq=0; return 1;}
+	if(RingUsed(&GpOpR)<sizeof(GpOp) || RingPeek(&GpOpR,0)!=GoStop) return 0;
+	RingSkip(&GpOpR,sizeof(GpOp));
+	return 1;
+}
+
+
+//Routine sets pin directions and 75160/162 to talk mode (DDRtalk).
+static void SetTalk(void){
+	CtlDir(Msk(PinNRFD)|Msk(PinNDAC),0);
+	TE(1);
+	CtlDir(Msk(PinEOI)|Msk(PinDAV),1);
+	DioDir(1);
+}
+
+//Routine sets pin directions and 75160/162 to listen mode (DDRlstn).
+static void SetListen(void){
+	DioDir(0);
+	CtlDir(Msk(PinEOI)|Msk(PinDAV),0);
+	TE(0);
+	CtlDir(Msk(PinNRFD)|Msk(PinNDAC),1);
+}
+
+//Routine releases all lines except REN and pulses IFC for 100 us.
+static void IfcPulse(void){
+	CtlOut(0,Msk(PinEOI)|Msk(PinDAV)|Msk(PinNRFD)|Msk(PinNDAC)|Msk(PinATN));
+	RENout(!RenOn);
+	SetListen();
+	IFCout(0);
+	DioWr(0xff);
+	delayMicroseconds(100);
+	IFCout(1);
+}
+
+static void PowerOn(void){
+	if(pwr) return;
+	pwr=1;
+	DC(0);
+	CtlDir(Msk(PinATN)|Msk(PinIFC)|Msk(PinREN),1);	// DDRcomm
+	IfcPulse();
+}
+
+static void PowerOff(void){
+	DioDir(0);
+	CtlDir(Msk(PinEOI)|Msk(PinDAV)|Msk(PinNRFD)|Msk(PinNDAC)|Msk(PinATN)|Msk(PinIFC)|Msk(PinREN),0);
+	DC(0); TE(0);
+	pwr=0;
+	RenOn=1;
+}
+
+
+/*
+Routine sends command to GPIB.
+ATN is not released at normal operation. On error routine releases ATN.
+Talk mode should be set prior to call.
+*/
+static uint8_t IRAM_ATTR SendCmd(uint8_t cmd){
+	ATNout(0);
+	DioWr(~cmd);
+	while(NDACin&&NRFDin) if(TmoChk()) {brk|=NoLstn; goto Ret;}
+	TimRst();
+	HsWait(!NRFDin,NotRdyBrk,PhCmd)
+	DAVout(0);
+	HsWait(!NDACin,NotAccBrk,PhCmd)
+	DAVout(1);
+	CmdCnt++;
+	return brk;
+Ret:
+	ATNout(1);
+	return brk;
+}
+
+
+/*
+Routine sends n bytes from GpWrR to the bus. first is set for the first part of a
+message; the routine then waits for a listener and uses TMaxFirst for the first byte.
+eoi set asserts EOI with the last byte.
+Bytes are already in GpWrR, so unlike SendBinData there is no wait for the host.
+On error the rest of the n bytes is removed from GpWrR. Returns brk.
+*/
+static uint8_t IRAM_ATTR SendBinData(uint32_t n, uint8_t first, uint8_t eoi){
+	uint32_t k=0;
+	if(first){
+		TLim=TMaxFirst;
+		while(NDACin&&NRFDin) if(TmoChk()) {brk|=NoLstn; goto Ret;}	// Wait for listener
+	}
+	while(k<n){
+		DioWr(~RingGet(&GpWrR));
+		k++;
+		if(!(k&0xff)) HostWake();		// Room for more data
+		if(eoi && k==n) EOIout(0);
+		HsWait(!NRFDin,NotRdyBrk,PhNRFD)
+		DAVout(0);
+		HsWait(!NDACin,NotAccBrk,PhNDAC)
+		DAVout(1);
+		TimRst();
+		TLim=TMax;
+	}
+Ret:
+	EOIout(1);
+	if(k<n) RingSkip(&GpWrR,n-k);
+	XmtCnt+=k;
+	return brk;
+}
+
+
+/*
+Routine receives data from GPIB bus to GpRdR.
+Read ends with EOI, or also with EOS byte or count (mode, arg as RdMode, RdArg).
+While GpRdR is full the bus is held (NRFD) and the byte timeout does not run.
+With RdStore in mode data goes to the store (after its data with RdMore) and the
+read also ends when it is full. It also ends after max bytes if max is not 0; the
+rest stays with the talker for the next read.
+Read is stopped by GoStop from the host; it is checked only while the routine waits.
+e->n is set to number of bytes, e->eoi to 1 if EOI was received. Returns brk.
+*/
+static uint8_t IRAM_ATTR RcvBinData(uint8_t mode, uint8_t arg, uint32_t max, GpEv *e){
+	uint8_t c, eoi, st=mode&RdStore, *sp=GpSt;
+	uint32_t n=0, i, sm=GpStMax, t0;
+	if(st){
+		if(!(mode&RdMore)) StLen=0;
+		sp+=StLen;
+		sm-=StLen;
+	}
+	mode&=~(RdStore|RdMore);
+	NDACout(0);
+	ATNout(1);
+	TLim=TMaxFirst;
+	if(st && !sm) goto Ret;				// Store is full
+	do{
+		while(!st && !RingFree(&GpRdR)){	// Host does not take data
+			TimRst();
+			SrqChk();
+			if(StopChk() || TmoChk()) goto Ret;
+		}
+		NRFDout(1);						// Ready for data
+		if(DAVin){						// Wait for data
+			t0=Micros();
+			while(DAVin){
+				SrqChk();
+				if(StopChk()) {HistAdd(PhDAV,t0); goto Ret;}
+				if(TmoChk()) {brk|=NoData; HistAdd(PhDAV,t0); goto Ret;}
+			}
+			HistAdd(PhDAV,t0);
+		}
+		i=In0();						// Data and EOI in one sample
+		c=~DioGet(i,In1());				// Accept data
+		if(st) sp[n]=c;
+		else RingPut(&GpRdR,c);
+		eoi=CtlBit(i,PinEOI);
+		CtlOut(Msk(PinNRFD),Msk(PinNDAC));	// Not ready for more data, data received
+		n++;
+		if(!(n&0xff) && !st) HostWake();
+		if(!eoi) e->eoi=1;
+		if(st && n==sm) eoi=0;			// Store is full
+		if(n==max) eoi=0;				// Part of a long read
+		if(mode) if(mode==RdEOS ? c==arg : n==arg) eoi=0;	// EOS or count
+		TimRst();
+		TLim=TMax;
+		HsWait(!DAVin,NotDAVrel,PhDAV)	// Wait for DAV rel.
+		NDACout(0);						// Data not accepted (no data on bus)
+	}while(eoi);
+Ret:
+	if(st) StLen+=n;
+	e->n=n;
+	RcvCnt+=n;
+	return brk;
+}
+
+
+//Routine receives one byte to GpRdR (for serial polling). NUL is stored on error.
+static uint8_t IRAM_ATTR RcvBinByte(void){
+	NDACout(0);
+	ATNout(1);
+	TLim=TMax;
+	NRFDout(1);
+	while(DAVin) if(TmoChk()) {brk|=NoData; goto Ret;}
+	RingPut(&GpRdR,~DioRd());
+	CtlOut(Msk(PinNRFD),Msk(PinNDAC));
+	RcvCnt++;
+	return brk;
+Ret:
+	RingPut(&GpRdR,NUL);
+	return brk;
+}
+
+
+//Routine sends n bus commands from GpWrR. ATN is released after the last one if rel is set.
+static uint8_t BusCmd(uint32_t n, uint8_t rel){
+	uint32_t k=0;
+	SetTalk();
+	while(k<n){
+		k++;
+		if(SendCmd(RingGet(&GpWrR))) break;
+	}
+	if(k<n) RingSkip(&GpWrR,n-k);
+	if(brk) return brk;
+	SetListen();
+	if(rel) ATNout(1);
+	return brk;
+}
+
+
+/*
+Routine addresses device a as listener, or as talker if talk is set, and controller c
+as the other one (UNL, TAD, LAD). ATN is released after the last command.
+*/
+static uint8_t BusAddr(uint8_t a, uint8_t c, uint8_t talk){
+	SetTalk();
+	if(SendCmd(0x3f) || SendCmd(0x40|(talk ? a : c)) || SendCmd(0x20|(talk ? c : a))) return brk;
+	SetListen();
+	ATNout(1);
+	return brk;
+}
+
+
+static uint8_t ReadData(uint8_t mode, uint8_t arg, uint32_t max, GpEv *e){
+	NRFDout(0);			// Set Not Ready For Data before releasing ATN to prevent No listener condition
+	SetListen();
+	if(RcvBinData(mode,arg,max,e)) return brk;
+	NDACout(1);
+	return brk;
+}
+
+
+static uint8_t ReadByte(void){
+	NRFDout(0);
+	SetListen();
+	if(RcvBinByte()) return brk;
+	NDACout(1);
+	return brk;
+}
+
+
+//Routine returns result byte from brk and clears it, as BrkRes.
+static uint8_t BrkRes(void){
+	uint8_t c;
+	switch(brk&0x0f){
+		case 0: c=ACK; break;
+		case NotRdyBrk: c=1; break;
+		case NotAccBrk: c=2; break;
+		case NoLstn: c=8; break;
+		case NoData: c=9; break;
+		case NotDAVrel: c=3; break;
+		default: c=NAK;
+	}
+	if((brk&0x0f) && (brk&0x0f)<=NotDAVrel) GpErr(brk&0x0f);
+	if(brk&TimOutBrk){			// Time Out Occured
+		SetListen();
+		if((brk&0x0f)!=NoData) IfcPulse();	// Do not reset GPIB if no data were received (support for serial poll)
+	}
+	brk=0;
+	return c;
+}
+
+
+#if GpSim
+/*
+Simulated bus (GpSim). No line is driven; reads take 1 ms per SimRate bytes.
+Devices at addresses 1-29 keep the last message written to them; a read returns
+"WGPIB,SIM,<address>,0\n" after *IDN?, n digits and LF after DATA? <n> and the
+last message otherwise, EOI is set with its last byte. A read which ends before
+continues there. Write without a listener fails with NoLstn, read without a
+talker with NoData; there is no device at SimNone, for tests of these errors.
+After HANG? the device does not talk: the read waits until it is stopped or for
+the timeout of the first byte, which ends it with NoData.
+*/
+#define SimLen 128
+#define SimNone 30				// Address without device
+#define SimRate 1000
+static uint8_t SimLstn=0xff, SimTalk=0xff;	// Addressed listener and talker
+static uint8_t SimMsg[31][SimLen];
+static uint8_t SimCnt[31];
+static uint32_t SimPos[31];					// Bytes of the response read
+
+static void SimCmd(uint32_t n){
+	uint8_t c;
+	while(n--){
+		c=RingGet(&GpWrR)&0x7f;
+		if(c==0x3f) SimLstn=0xff;					// UNL
+		else if(c==0x5f) SimTalk=0xff;				// UNT
+		else if(c>=0x20 && c<0x3f) SimLstn=c&0x1f;	// LAD
+		else if(c>=0x40 && c<0x5f) SimTalk=c&0x1f;	// TAD
+		CmdCnt++;
+	}
+}
+
+static void SimWrite(GpOp *o){
+	uint8_t *m, c;
+	uint32_t n=o->n;
+	if(!SimLstn || SimLstn>=SimNone){
+		RingSkip(&GpWrR,n);
+		brk=NoLstn;
+		return;
+	}
+	m=SimMsg[SimLstn];
+	if(o->flg&GfNew) SimCnt[SimLstn]=SimPos[SimLstn]=0;
+	while(n--){
+		c=RingGet(&GpWrR);
+		if(SimCnt[SimLstn]<SimLen) m[SimCnt[SimLstn]++]=c;
+	}
+	XmtCnt+=o->n;
+}
+
+static void SimRead(uint8_t mode, uint8_t arg, uint32_t max, GpEv *e){
+	uint8_t st=mode&RdStore, r[SimLen], *p, c, *sp=GpSt;
+	uint32_t n=0, k, d=0, *pos, sm=GpStMax, t0;
+	if(st){
+		if(!(mode&RdMore)) StLen=0;
+		sp+=StLen;
+		sm-=StLen;
+	}
+	mode&=~(RdStore|RdMore);
+	if(!SimTalk || SimTalk>=SimNone) {brk=NoData; return;}
+	p=SimMsg[SimTalk];
+	k=SimCnt[SimTalk];
+	pos=&SimPos[SimTalk];
+	if(k>=5 && !memcmp(p,"*IDN?",5)){
+		k=snprintf((char *)r,sizeof(r),"WGPIB,SIM,%u,0\n",SimTalk);
+		p=r;
+	}
+	else if(k>=5 && !memcmp(p,"HANG?",5)){
+		t0=Micros();
+		while(!StopChk()){
+			if(TMaxFirst && Micros()-t0>=TMaxFirst) {brk=NoData; break;}
+			vTaskDelay(1);
+		}
+		goto Ret;
+	}
+	else if(k>=5 && !memcmp(p,"DATA?",5)){
+		p[k<SimLen ? k : SimLen-1]=0;
+		d=strtoul((char *)p+5,0,10)+1;
+		k=d;
+	}
+	if(*pos>=k) *pos=0;
+	while(*pos<k){
+		if(st && n==sm) break;
+		c=d ? (*pos==d-1 ? '\n' : '0'+*pos%10) : p[*pos];
+		if(st) sp[n]=c;
+		else{
+			while(!RingFree(&GpRdR)){		// Host does not take data
+				HostWake();
+				if(StopChk()) goto Ret;
+				vTaskDelay(1);
+			}
+			RingPut(&GpRdR,c);
+		}
+		n++;
+		(*pos)++;
+		if(!(n%SimRate)) delayMicroseconds(1000);
+		if(mode ? (mode==RdEOS ? c==arg : n==arg) : 0) break;
+		if(n==max) break;
+	}
+	e->eoi=*pos==k;
+	if(e->eoi) *pos=0;
+Ret:
+	if(st) StLen+=n;
+	e->n=n;
+	RcvCnt+=n;
+}
+
+//Routine executes operation o on the simulated bus. Returns 0 if there is no event.
+static uint8_t SimExec(GpOp *o, GpEv *e){
+	switch(o->op){
+		case GoCmd:
+			SimCmd(o->n);
+			break;
+		case GoAddr:
+			SimLstn=o->flg&GfTalk ? o->n : o->arg;
+			SimTalk=o->flg&GfTalk ? o->arg : o->n;
+			CmdCnt+=3;
+			break;
+		case GoWrite:
+			SimWrite(o);
+			e->n=o->n;
+			if(brk) WrSkip=1;
+			else if(!(o->flg&GfEnd)) return 0;
+			break;
+		case GoRead:
+			if((o->flg&RdStore) && !GpStMax) {brk=0x0f; break;}
+			SimRead(o->flg,o->arg,o->n,e);
+			break;
+		case GoRdByte:
+			RingPut(&GpRdR,0);				// Status byte
+			break;
+		case GoNop:
+		case GoIFC:
+		case GoStat:
+			break;
+		default:
+			brk=0x0f;
+	}
+	return 1;
+}
+#endif
+
+
+//Routine executes operation o and sends its event.
+static void Exec(GpOp *o){
+	GpEv e;
+	memset(&e,0,sizeof(e));
+	e.op=o->op;
+	switch(o->op){
+		case GoTmo:
+			if(o->arg==TmByte) TMax=o->n;
+			else if(o->arg==TmTot) TMaxTot=o->n;
+			else TMaxFirst=o->n;
+			return;
+		case GoRen:
+			RenOn=o->arg;
+			if(pwr) RENout(!RenOn);
+			return;
+		case GoOff:
+			PowerOff();
+			return;
+		case GoStop:
+			return;
+		case GoWrite:
+			if(o->flg&GfNew) WrSkip=0;
+			if(WrSkip){					// Rest of failed message
+				RingSkip(&GpWrR,o->n);
+				return;
+			}
+	}
+#if GpSim
+	if(!SimExec(o,&e)) return;
+#else
+	PowerOn();
+	TimRst();							// Enable timeouts
+	if(o->op!=GoWrite || o->flg&GfNew) TTot=Micros();	// Total timeout runs over all parts
+	TLim=TMax;
+	switch(o->op){
+		case GoNop:
+			break;
+		case GoCmd:
+			BusCmd(o->n,o->flg&GfRel);
+			break;
+		case GoAddr:
+			BusAddr(o->arg,o->n,o->flg&GfTalk);
+			break;
+		case GoWrite:
+			if(o->flg&GfNew) SetTalk();
+			SendBinData(o->n,o->flg&GfNew,(o->flg&(GfEnd|GfEOI))==(GfEnd|GfEOI));
+			e.n=o->n;
+			if(brk) WrSkip=1;
+			else if(o->flg&GfEnd) SetListen();
+			else return;				// Event after the last part
+			break;
+		case GoRead:
+			if((o->flg&RdStore) && !GpStMax) {brk=0x0f; break;}
+			ReadData(o->flg,o->arg,o->n,&e);
+			break;
+		case GoRdByte:
+			ReadByte();
+			break;
+		case GoIFC:
+			TE(0);
+			IfcPulse();
+			break;
+		case GoStat:
+			e.stat=CtlRd();
+			break;
+		default:
+			brk=0x0f;					// NAK
+	}
+#endif
+	e.res=BrkRes();
+	e.t=Micros();
+	EvPut(&e);
+}
+
+
+static void GpTask(void *arg){
+	GpOp o;
+	for(;;){
+		if(RingUsed(&GpOpR)<sizeof(GpOp)){
+			SrqChk();
+			ulTaskNotifyTake(pdTRUE,1);	// Woken by GpPut; SRQ is checked every tick
+			continue;
+		}
+		RingRead(&GpOpR,&o,sizeof(o));
+		Exec(&o);
+	}
+}
+
+
+/*
+Routine sets up pins and rings and starts GpTask on core 1.
+Lines are left undriven until the first bus operation, as after reset of BSC.C.
+*/
+void GpBegin(void){
+	static const uint8_t Pins[]={PinDIO1,PinDIO2,PinDIO3,PinDIO4,PinDIO5,PinDIO6,PinDIO7,PinDIO8,
+		PinREN,PinIFC,PinNDAC,PinNRFD,PinDAV,PinEOI,PinATN,PinSRQ};
+	uint8_t i;
+	RingInit(&GpOpR,OpBuf,OpRLen);
+	RingInit(&GpWrR,WrBuf,WrRLen);
+	RingInit(&GpRdR,RdBuf,RdRLen);
+	RingInit(&GpEvR,EvBuf,EvRLen);
+	GpMtx=xSemaphoreCreateMutex();
+	GpStMax=psramFound() ? StPsLen : StHeapLen;
+	GpSt=(uint8_t *)(psramFound() ? ps_malloc(GpStMax) : malloc(GpStMax));
+	if(!GpSt) GpStMax=0;
+	for(i=0;i<sizeof(Pins);i++) pinMode(Pins[i],INPUT);	// GPIO function, W1TS/W1TC are used then
+	pinMode(PinTE,OUTPUT); pinMode(PinDC,OUTPUT);
+	PowerOff();
+	xTaskCreatePinnedToCore(GpTask,"gpib",4096,0,configMAX_PRIORITIES-1,&GpHnd,1);
+}
+
+
+/*
+Host side. A host task takes GpLock for a transaction (a command, or a sequence of
+commands which must not be interleaved with others), then it is the only producer
+of GpOpR, GpWrR and the only consumer of GpRdR, GpEvR.
+
+Scheduler. Each host session (GpSes) waits for at most one transaction. When the
+bus is released it goes to the waiting session of the highest class; within the
+class to the one with the lowest start tag (start-time fair queuing): a session
+starts at max(virtual time, finish tag of its last transaction) and its finish tag
+grows by the bus time it used divided by its weight. So a session which used the
+bus for long waits behind others, and a query never waits behind more than one
+GpChunk part of a long read. Sessions of the devices of a long read (rsv) wait
+up to its end; they would address the talker while its response is not read.
+*/
+
+//Routine registers session s of the calling task with weight w (1-255).
+void GpSesInit(GpSes *s, uint8_t w){
+	memset(s,0,sizeof(GpSes));
+	s->w=w ? w : 1;
+	s->dev=GpDevAll;
+	s->tmo[TmByte]=TMax_def;
+	s->tmo[TmTot]=TMaxTot_def;
+	s->tmo[TmFirst]=TMaxFirst_def;
+	s->task=xTaskGetCurrentTaskHandle();
+	xSemaphoreTake(GpMtx,portMAX_DELAY);
+	s->fin=SesV;
+	s->next=SesList;
+	SesList=s;
+	xSemaphoreGive(GpMtx);
+}
+
+//Routine removes session s; it does not hold the bus.
+void GpSesEnd(GpSes *s){
+	GpSes **p;
+	xSemaphoreTake(GpMtx,portMAX_DELAY);
+	for(p=&SesList;*p;p=&(*p)->next) if(*p==s) {*p=s->next; break;}
+	xSemaphoreGive(GpMtx);
+}
+
+/*
+Routine returns 1 if no other session which has used the bus is registered. Settings
+of the controller for all sessions (power, REN) are changed only then.
+*/
+uint8_t GpSesAlone(GpSes *s){
+	GpSes *o;
+	uint8_t r=1;
+	xSemaphoreTake(GpMtx,portMAX_DELAY);
+	for(o=SesList;o;o=o->next) if(o!=s && o->act) r=0;
+	xSemaphoreGive(GpMtx);
+	return r;
+}
+
+//Routine returns 1 if session s has to wait for the end of a long read of its devices. Caller holds GpMtx.
+static uint8_t SesHeld(GpSes *s){
+	GpSes *o;
+	for(o=SesList;o;o=o->next) if(o->rsv && o!=s && (o->dev&s->dev)) return 1;
+	return 0;
+}
+
+//Routine gives the bus to s. Caller holds GpMtx.
+static void SesGrant(GpSes *s){
+	uint32_t t=Micros()-s->tq;
+	SesOwn=s;
+	StopReq=0;							// GpStop of the session before
+	SesV=s->st;
+	SesSeq++;
+	s->wait=0;
+	s->tg=Micros();
+	SchGrant[s->cls]++;
+	SchWaitUs[s->cls]+=t;
+	if(t>SchMaxUs[s->cls]) SchMaxUs[s->cls]=t;
+	GpHost=(TaskHandle_t)s->task;
+	s->grant=1;
+	if(s->task!=xTaskGetCurrentTaskHandle()) xTaskNotifyGive((TaskHandle_t)s->task);
+}
+
+/*
+Routine queues session s for the bus for a transaction of class cls and returns;
+the session has the bus when s->grant is set. For tasks which serve their link
+while they wait; GpLock waits.
+*/
+void GpQueue(GpSes *s, uint8_t cls){
+	xSemaphoreTake(GpMtx,portMAX_DELAY);
+	s->cls=cls<GcNum ? cls : GcBulk;
+	s->act=1;
+	s->st=(int32_t)(s->fin-SesV)>0 ? s->fin : SesV;
+	s->tq=Micros();
+	s->grant=0;
+	if(!SesOwn && !SesHeld(s)) SesGrant(s);
+	else{
+		s->wait=1;
+		SchWait[s->cls]++;
+	}
+	xSemaphoreGive(GpMtx);
+}
+
+//Routine waits until session s gets the bus for a transaction of class cls.
+void GpLock(GpSes *s, uint8_t cls){
+	GpQueue(s,cls);
+	while(!s->grant) ulTaskNotifyTake(pdTRUE,pdMS_TO_TICKS(10));
+}
+
+//Routine releases the bus of s and gives it to the next waiting session. Caller holds GpMtx.
+static void SesRel(GpSes *s){
+	GpSes *o, *n=0;
+	s->fin=s->st+(Micros()-s->tg)/s->w;
+	s->grant=0;
+	SesOwn=0;
+	for(o=SesList;o;o=o->next){
+		if(!o->wait || SesHeld(o)) continue;
+		if(!n || o->cls<n->cls || (o->cls==n->cls && (int32_t)(o->st-n->st)<0)) n=o;
+	}
+	if(n){
+		SchWait[n->cls]--;
+		SesGrant(n);
+	}
+}
+
+//Routine releases the bus; it ends the long read of s, if any.
+void GpUnlock(GpSes *s){
+	xSemaphoreTake(GpMtx,portMAX_DELAY);
+	s->rsv=0;
+	SesRel(s);
+	xSemaphoreGive(GpMtx);
+}
+
+/*
+Routine gives the bus to a waiting session of other devices between parts of a long
+read, if it goes first: it has a higher class than cls, or the same one and a start
+tag not above the one of the next part of s. Then it waits for the bus again with
+class cls. The devices of s (s->dev) stay reserved up to GpUnlock. Returns 1 if the
+bus was given away, the caller then addresses the device again.
+*/
+uint8_t GpYield(GpSes *s, uint8_t cls){
+	GpSes *o;
+	uint32_t q, f;
+	xSemaphoreTake(GpMtx,portMAX_DELAY);
+	f=s->st+(Micros()-s->tg)/s->w;		// Start tag of the next part
+	for(o=SesList;o;o=o->next){
+		if(!o->wait || (o->dev&s->dev) || SesHeld(o)) continue;
+		if(o->cls<cls || (o->cls==cls && (int32_t)(o->st-f)<=0)) break;
+	}
+	if(!o){
+		xSemaphoreGive(GpMtx);
+		return 0;
+	}
+	s->rsv=1;
+	q=SesSeq;
+	SesRel(s);
+	xSemaphoreGive(GpMtx);
+	GpLock(s,cls);
+	return SesSeq!=q+1;					// Others had the bus
+}
+
+//Routine waits for the engine for up to ms.
+void GpWait(uint32_t ms){
+	ulTaskNotifyTake(pdTRUE,pdMS_TO_TICKS(ms));
+}
+
+//Routine puts operation o to GpOpR; it waits while the ring is full.
+static void OpPut(const GpOp *o){
+	while(RingFree(&GpOpR)<sizeof(GpOp)) GpWait(1);
+	RingWrite(&GpOpR,o,sizeof(GpOp));
+	xTaskNotifyGive(GpHnd);
+}
+
+/*
+Routine puts operation o to the engine. Timeouts of the session which has the bus
+go first if they are not the ones of the engine, so each session runs with its own.
+*/
+void GpPut(const GpOp *o){
+	GpSes *s=SesOwn;
+	GpOp m={GoTmo,0,0,0,0};
+	for(;s && m.arg<3;m.arg++){
+		if(s->tmo[m.arg]==TmoOp[m.arg]) continue;
+		m.n=TmoOp[m.arg]=s->tmo[m.arg];
+		OpPut(&m);
+	}
+	OpPut(o);
+}
+
+//Routine sets timeout t (TmByte, TmTot, TmFirst) of session s to us, 0 disables it. It applies from its next operation.
+void GpTmo(GpSes *s, uint8_t t, uint32_t us){
+	s->tmo[t]=us;
+}
+
+//Routine puts n bytes to GpWrR; it waits for room. Data of one operation must fit into the ring.
+void GpData(const uint8_t *p, uint32_t n){
+	uint32_t k;
+	while(n){
+		k=RingFree(&GpWrR);
+		if(!k) {GpWait(1); continue;}
+		if(k>n) k=n;
+		RingWrite(&GpWrR,p,k);
+		p+=k; n-=k;
+	}
+}
+
+//Routine takes the next event to e. It waits up to ms. Returns 0 if there is none.
+uint8_t GpGet(GpEv *e, uint32_t ms){
+	if(RingUsed(&GpEvR)<sizeof(GpEv)) GpWait(ms);
+	if(RingUsed(&GpEvR)<sizeof(GpEv)) return 0;
+	RingRead(&GpEvR,e,sizeof(GpEv));
+	return 1;
+}
+
+//Routine puts an operation and waits for its event. Returns the result byte.
+uint8_t GpDo(uint8_t op, uint8_t flg, uint8_t arg, uint32_t n, GpEv *e){
+	GpOp o={op,flg,arg,0,n};
+	GpPut(&o);
+	while(!GpGet(e,1000));
+	return e->res;
+}
+
+/*
+Routine takes the store for a stored read (RdStore), which is to be put next.
+Data of the previous stored read is lost. Returns id of the read for GpFetch.
+*/
+uint32_t GpStore(void){
+	return __atomic_add_fetch(&GpStId,1,__ATOMIC_SEQ_CST);
+}
+
+/*
+Routine copies n bytes at off of stored read id to p; the caller checks the range.
+The copy is checked afterwards, as the store can be taken by another stored read
+meanwhile. Returns 0 if the data is not the one of read id (anymore).
+*/
+uint8_t GpFetch(uint32_t id, uint32_t off, uint8_t *p, uint32_t n){
+	if(__atomic_load_n(&GpStId,__ATOMIC_ACQUIRE)!=id) return 0;
+	if(n) memcpy(p,GpSt+off,n);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&GpStId,__ATOMIC_RELAXED)==id;
+}
+
+
+//Routine counts failure with break cause (NotAccBrk ... DataFrmtErr); also for errors of the host data.
+void GpErr(uint8_t cause){
+	__atomic_add_fetch(&ErrCnt[cause-1],1,__ATOMIC_RELAXED);
+}
+
+
+/*
+Routine stops the read running for session s, as GoStop; for other tasks of the
+session, e.g. device clear. Nothing is done if s does not have the bus.
+*/
+void GpStop(GpSes *s){
+	xSemaphoreTake(GpMtx,portMAX_DELAY);
+	if(SesOwn==s){
+		StopReq=1;
+		xTaskNotifyGive(GpHnd);
+	}
+	xSemaphoreGive(GpMtx);
+}
+
+
+/*
+Routine writes performance counters as text in Prometheus exposition format to p,
+as IBP command of BSC.C. Returns the length.
+*/
+int GpMetrics(char *p, int max){
+	static const char *ErrName[DataFrmtErr]={"NotAccBrk","NotRdyBrk","NoLstn","NoData","NotDAVrel","DataFrmtErr"};
+	static const char *ClsName[GcNum]={"srq","query","bulk"};
+	static const char *PhName[PhNum]={"nrfd","ndac","dav","cmd"};
+	static const char *LeName[HistBins]={"4e-06","1.6e-05","6.4e-05","0.000256","0.001024","0.004096","0.016384","+Inf"};
+	uint32_t c;
+	uint64_t t;
+	int n, i, j;
+	n=snprintf(p,max,
+		"# TYPE gpib_bytes_written_total counter\ngpib_bytes_written_total %u\n"
+		"# TYPE gpib_bytes_read_total counter\ngpib_bytes_read_total %u\n"
+		"# TYPE gpib_bus_commands_total counter\ngpib_bus_commands_total %u\n"
+		"# TYPE gpib_srq_total counter\ngpib_srq_total %u\n"
+		"# TYPE gpib_store_size_bytes gauge\ngpib_store_size_bytes %u\n"
+		"# TYPE gpib_errors_total counter\n",
+		(unsigned)XmtCnt,(unsigned)RcvCnt,(unsigned)CmdCnt,(unsigned)SrqCnt,(unsigned)GpStMax);
+	for(i=0;i<DataFrmtErr && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_errors_total{cause=\"%s\"} %u\n",ErrName[i],(unsigned)ErrCnt[i]);
+	if(n<max) n+=snprintf(p+n,max-n,"# TYPE gpib_sched_queue_depth gauge\n");
+	for(i=0;i<GcNum && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_sched_queue_depth{class=\"%s\"} %u\n",ClsName[i],(unsigned)SchWait[i]);
+	if(n<max) n+=snprintf(p+n,max-n,"# TYPE gpib_sched_transactions_total counter\n");
+	for(i=0;i<GcNum && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_sched_transactions_total{class=\"%s\"} %u\n",ClsName[i],(unsigned)SchGrant[i]);
+	if(n<max) n+=snprintf(p+n,max-n,"# TYPE gpib_sched_wait_seconds_total counter\n");
+	for(i=0;i<GcNum && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_sched_wait_seconds_total{class=\"%s\"} %u.%06u\n",ClsName[i],
+			(unsigned)(SchWaitUs[i]/1000000),(unsigned)(SchWaitUs[i]%1000000));
+	if(n<max) n+=snprintf(p+n,max-n,"# TYPE gpib_sched_wait_max_seconds gauge\n");
+	for(i=0;i<GcNum && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_sched_wait_max_seconds{class=\"%s\"} %u.%06u\n",ClsName[i],
+			(unsigned)(SchMaxUs[i]/1000000),(unsigned)(SchMaxUs[i]%1000000));
+	if(n<max) n+=snprintf(p+n,max-n,"# TYPE gpib_handshake_wait_seconds histogram\n");
+	for(i=0;i<PhNum && n<max;i++){
+		c=0;
+		for(j=0;j<HistBins && n<max;j++){
+			c+=Hist[i][j];
+			n+=snprintf(p+n,max-n,"gpib_handshake_wait_seconds_bucket{phase=\"%s\",le=\"%s\"} %u\n",PhName[i],LeName[j],(unsigned)c);
+		}
+		t=PhTime[i];
+		if(n<max) n+=snprintf(p+n,max-n,"gpib_handshake_wait_seconds_sum{phase=\"%s\"} %u.%06u\n"
+			"gpib_handshake_wait_seconds_count{phase=\"%s\"} %u\n",
+			PhName[i],(unsigned)(t/1000000),(unsigned)(t%1000000),PhName[i],(unsigned)c);
+	}
+	return n<max ? n : max-1;
+}
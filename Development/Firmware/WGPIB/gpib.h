@@ -0,0 +1,205 @@
+/*
+GPIB engine of WGPIB firmware.
+Bus routines of BSC.C (ATmega8515) ported to ESP32. The engine runs as GpTask
+pinned to core 1, Wi-Fi, TCP/IP and host sessions run on core 0.
+The host side talks to the engine only through four SPSC rings:
+	GpOpR	operations (GpOp), host -> engine
+	GpWrR	bus command and data bytes of GoCmd and GoWrite, host -> engine
+	GpRdR	bytes read from the bus, engine -> host
+	GpEvR	end of operations (GpEv), engine -> host
+Data of an operation is put into GpWrR before the operation, read data is in
+GpRdR before its event. Only one host task uses the rings at a time: the one which
+the scheduler has given the bus (GpLock). Sessions wait in priority classes (GcSrq,
+GcQuery, GcBulk) and within a class get the bus time in proportion to their weights
+(start-time fair queuing). A bus transaction is never interrupted; long reads are
+done in parts of GpChunk and yield between them (GpYield), only to sessions of
+other devices (GpSes.dev): a device is not addressed by others up to the end of its
+response, as IEEE 488.2 would discard it (query interrupted).
+A read with RdStore goes to the store (GpSt) instead of GpRdR: the engine does not
+wait for the host, so the bus is released at bus speed and the data is fetched later
+(GpFetch) at network speed, without GpLock.
+*/
+
+#ifndef GPIB_H
+#define GPIB_H
+
+#include <stdint.h>
+#include "ring.h"
+
+// ASCII characters
+#define NUL 0
+#define SOH 1
+#define STX 2
+#define ETX 3
+#define EOT 4
+#define ENQ 5
+#define ACK 6
+
+#define DLE 16
+#define NAK 21
+#define ETB 23
+#define CAN 24
+#define ESC 27
+
+#ifndef GpSim
+#define GpSim 0			// 1: simulated bus instead of the lines, for tests of host links without instruments (host/)
+#endif
+
+// Port connection, ESP-WROOM-32 (D2) GPIO numbers
+// DIO1-8 through TXS0108E U2, control lines through U3 to SN75160 (D3) and SN75162 (D4)
+#define PinDIO1 22
+#define PinDIO2 2
+#define PinDIO3 32
+#define PinDIO4 33
+#define PinDIO5 25
+#define PinDIO6 26
+#define PinDIO7 27
+#define PinDIO8 14
+#define PinREN 23
+#define PinIFC 21
+#define PinNDAC 19
+#define PinNRFD 18
+#define PinDAV 5
+#define PinEOI 17
+#define PinATN 16
+#define PinSRQ 4
+#define PinTE 13		// Talk Enable, O; also LED DS5
+#define PinDC 15		// Direction control, O; 0: system controller; also LED DS4
+// PE of SN75160 is derived from ATN and EOI by U5, it has no pin.
+
+// Error bits; variable brk
+#define NotAccBrk 0x01	// Not Accepted Break; Listener(s) didn't release NDAC.
+#define NotRdyBrk 0x02	// Not Ready Break; Listener(s) were not ready in time. (NRFD pulled low)
+#define NoLstn 0x03		// No Listener; NRFD and NDAC were sensed high
+#define NoData 0x04		// No Data received: Timer expired while waiting for data
+#define NotDAVrel 0x05	// DAV line not released: Timer expired while waiting for DAV line to be released during data reception
+#define DataFrmtErr 0x06	// DLE not followed by DLE or ETX in write data of the host; counted by GpErr
+#define TimOutBrk 0x40	// Timout Break; Timer expired
+
+// Operations; GpOp.op
+#define GoNop 0x00		// Powers on; event ACK
+#define GoCmd 0x01		// Sends n bus commands from GpWrR; GfRel releases ATN after the last one
+#define GoWrite 0x02	// Writes n data bytes from GpWrR, see GfNew, GfEnd, GfEOI
+#define GoRead 0x03		// Reads data to GpRdR; flg is end of read (RdEOI ...), arg is EOS byte or count, n is limit (0: none)
+#define GoRdByte 0x04	// Reads one byte to GpRdR, NUL on error
+#define GoIFC 0x05		// Interface clear
+#define GoStat 0x06		// State of control lines to GpEv.stat
+#define GoTmo 0x07		// Sets timeout arg (TmByte, TmTot, TmFirst) to n us, 0 disables it; no event. Put by GpPut, see GpTmo
+#define GoRen 0x08		// arg 1 asserts REN when powered on (default), 0 leaves it unasserted; no event
+#define GoOff 0x09		// Powers off; no event
+#define GoStop 0x0a		// Stops a read in progress, as ESC; ignored otherwise, no event
+#define GoAddr 0x0b		// Addresses device arg as listener (as talker with GfTalk), controller n as the other; releases ATN
+
+// Flags; GpOp.flg
+#define GfRel 0x01		// GoCmd: release ATN
+#define GfEOI 0x01		// GoWrite: EOI with the last byte of the part with GfEnd
+#define GfNew 0x02		// GoWrite: first part of a message
+#define GfEnd 0x04		// GoWrite: last part of a message; the event comes after it or after an error
+#define GfTalk 0x01		// GoAddr: device talks
+
+// Timeouts; GpOp.arg of GoTmo, t of GpTmo
+#define TmByte 0
+#define TmTot 1
+#define TmFirst 2
+
+// End of read; GpOp.flg of GoRead
+#define RdEOI 0x00		// EOI only
+#define RdEOS 0x20		// Byte arg or EOI
+#define RdCnt 0x40		// arg bytes or EOI
+#define RdStore 0x80	// ORed: read to the store; it also ends when the store is full
+#define RdMore 0x10		// ORed with RdStore: data is added to the one of the last stored read
+
+#define TMax_def 1000000		// Byte timeout, us
+#define TMaxTot_def 0			// Total timeout, disabled
+#define TMaxFirst_def 1000000	// Timeout before the first byte, us
+
+// Ring sizes, powers of 2
+#define OpRLen 512
+#define WrRLen 4096
+#define RdRLen 8192
+#define EvRLen 512
+
+// Scheduler classes, in order of priority
+#define GcSrq 0			// Serial poll, SRQ service
+#define GcQuery 1		// Commands, messages and short reads
+#define GcBulk 2		// Rest of long reads
+#define GcNum 3
+
+#define GpChunk 4096	// Long reads yield the bus after each part of this size
+
+// Store of RdStore reads; in PSRAM if there is one, else in heap
+#define StPsLen (3UL<<20)
+#define StHeapLen (64UL<<10)
+
+#define MetLen 8192		// Text of the counters (GpMetrics, LnkMetrics, UdpMetrics), IBP and /metrics
+
+typedef struct{
+	uint8_t op;			// GoXxx
+	uint8_t flg;		// GfXxx or RdXxx
+	uint8_t arg;
+	uint8_t rsv;
+	uint32_t n;			// Number of bytes in GpWrR (GoCmd, GoWrite), limit (GoRead) or timeout
+} GpOp;
+
+typedef struct{
+	uint8_t op;			// Operation which ended
+	uint8_t res;		// Return byte: ACK, error (1, 2, 3, 8, 9) or NAK
+	uint8_t stat;		// Control lines as IBS, GoStat
+	uint8_t eoi;		// Read ended with EOI
+	uint32_t n;			// Bytes transferred
+	uint32_t t;			// Time of the end, us
+} GpEv;
+
+#define GpDev(a) (1UL<<(a))	// Bit of GPIB address a (0-30) in GpSes.dev
+#define GpDevAll 0xffffffffUL
+
+// Host session of the scheduler; GpSesInit
+typedef struct GpSes{
+	struct GpSes *next;
+	void *task;			// Task of the session (TaskHandle_t)
+	uint8_t w;			// Weight, share of bus time within a class; its task may change it (IBq)
+	uint8_t cls;		// Class of the transaction waiting or running
+	uint32_t dev;		// Devices the transaction addresses, GpDev bits; GpDevAll if not known
+	uint8_t wait;		// Waiting for the bus
+	uint8_t rsv;		// In a long read, its devices are reserved (GpYield ... GpUnlock)
+	uint8_t act;		// Has used the bus, see GpSesAlone
+	volatile uint8_t grant;	// Bus is given to the session
+	uint32_t st, fin;	// Start and finish tag of the transaction, virtual us
+	uint32_t tq, tg;	// Time queued and granted, us
+	uint32_t tmo[3];	// Timeouts of its operations (TmByte, TmTot, TmFirst), us; GpTmo
+} GpSes;
+
+extern Ring GpOpR, GpWrR, GpRdR, GpEvR;
+
+// Counters, written by the engine only
+extern volatile uint32_t XmtCnt, RcvCnt, CmdCnt;	// Data bytes written, read and commands sent
+extern volatile uint32_t SrqCnt;					// SRQ assertions; sessions send ENQ when it changes
+extern volatile uint8_t SrqLine;					// Current state of SRQ, 1 means active
+extern uint32_t GpStMax;							// Size of the store, 0 if it could not be allocated
+
+void GpBegin(void);
+uint32_t Micros(void);
+
+// Host side; callers hold GpLock
+void GpSesInit(GpSes *s, uint8_t w);
+void GpSesEnd(GpSes *s);
+uint8_t GpSesAlone(GpSes *s);
+void GpLock(GpSes *s, uint8_t cls);
+void GpQueue(GpSes *s, uint8_t cls);
+void GpUnlock(GpSes *s);
+uint8_t GpYield(GpSes *s, uint8_t cls);
+void GpTmo(GpSes *s, uint8_t t, uint32_t us);
+void GpPut(const GpOp *o);
+void GpData(const uint8_t *p, uint32_t n);
+uint8_t GpGet(GpEv *e, uint32_t ms);
+void GpWait(uint32_t ms);
+uint8_t GpDo(uint8_t op, uint8_t flg, uint8_t arg, uint32_t n, GpEv *e);
+uint32_t GpStore(void);
+
+// Any task, GpLock is not needed
+uint8_t GpFetch(uint32_t id, uint32_t off, uint8_t *p, uint32_t n);
+void GpErr(uint8_t cause);
+void GpStop(GpSes *s);
+int GpMetrics(char *p, int max);
+
+#endif
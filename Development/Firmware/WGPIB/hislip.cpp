@@ -0,0 +1,639 @@
+/*
+HiSLIP session of WGPIB firmware, see hislip.h.
+A client opens the synchronous channel (Initialize), then the asynchronous one
+(AsyncInitialize with the session ID). The sub-address of Initialize selects the
+GPIB address: "gpib0,<a>" or "hislip<a>"; "hislip0" and others use the default one.
+
+Synchronous channel: Data and DataEnd are forwarded as in scpi.cpp (payload is
+received into GpWrR, EOI is sent with the last byte of DataEnd). If the message
+contains '?' outside of blocks, the response is read up to EOI and returned as
+Data ... DataEnd with the MessageID of the message; if the message or the read
+fails, DataEnd is sent without data, so the client does not wait for its timeout.
+Trigger sends GET.
+Messages are executed in order as they come, so a client in overlapped mode can
+send messages without waiting for responses; synchronized mode works the same.
+
+Asynchronous channel: AsyncServiceRequest is pushed on each SRQ assertion, so the
+client does not poll. Status query is a serial poll of the device, device clear
+sends SDC, remote/local control uses REN, GTL and LLO. These requests wait for
+the bus in a queue (up to HisAQ); a lock request waits up to its timeout. The
+channel serves its other messages and SRQ meanwhile. Device clear first stops a
+read of the synchronous channel, so a device which does not answer is cleared
+without waiting for the timeout; the response is dropped.
+Locks are kept per GPIB address; messages of a session without the lock wait
+while another session holds it.
+Each channel is a session of the bus scheduler (GpSes): status query and device
+clear use class GcSrq, messages GcQuery. A long response is read in parts of
+GpChunk bytes, giving the bus to waiting sessions between them.
+*/
+
+#include <Arduino.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <netinet/tcp.h>
+#include "freertos/semphr.h"
+#include "gpib.h"
+#include "scpi.h"
+#include "hislip.h"
+
+#define HisCtl 0				// GPIB address of the controller
+#define HisMax 4				// Sessions at a time
+#define HisVer 0x0100			// Protocol version 1.0
+#define HisVendor 0x5747		// Vendor ID "WG"
+#define HisOverlap 1			// Mode offered in InitializeResponse: 1 overlapped, 0 synchronized
+#define HisTmo 2000				// Rest of a message is waited for up to this time, ms
+#define HisChunk 1024			// Response is sent in parts of at least this size, the last at EOI
+#define HisLkLen 32				// Shared lock name, longer names are cut
+#define HisAQ 4					// Requests of the asynchronous channel waiting for the bus
+
+// Message types
+#define HmInit 0
+#define HmInitResp 1
+#define HmFatal 2
+#define HmError 3
+#define HmLock 4
+#define HmLockResp 5
+#define HmData 6
+#define HmDataEnd 7
+#define HmClrDone 8
+#define HmClrAck 9
+#define HmRemote 10
+#define HmRemoteResp 11
+#define HmTrigger 12
+#define HmMaxSize 15
+#define HmMaxSizeResp 16
+#define HmAInit 17
+#define HmAInitResp 18
+#define HmAClear 19
+#define HmSrq 20
+#define HmStatus 21
+#define HmStatusResp 22
+#define HmAClearAck 23
+#define HmLockInfo 24
+#define HmLockInfoResp 25
+
+// Error codes of FatalError and Error
+#define HeHeader 1				// Fatal: poorly formed message header
+#define HeInit 3				// Fatal: invalid initialization sequence
+#define HeMaxCli 4				// Fatal: maximum number of clients exceeded
+#define HeType 1				// Error: unrecognized message type
+
+typedef struct{
+	uint8_t type, ctl;
+	uint32_t par;
+	uint32_t len;				// Payload length
+} HisHdr;
+
+typedef struct{
+	uint8_t used;				// Channels running: 1 synchronous, 2 asynchronous
+	uint16_t id;
+	uint8_t addr;				// GPIB address of the device
+	int sfd;					// Synchronous channel
+	volatile uint8_t end;		// A channel ended, the other one ends too
+	volatile uint8_t clr;		// Device clear: messages are dropped up to DeviceClearComplete
+	uint8_t overlap;
+	uint8_t lk;					// Lock held: 1 exclusive, 2 shared; HisMtx
+	char lkname[HisLkLen];
+	uint32_t MaxMsg;			// Largest payload the client takes
+	uint32_t SrqSeen;			// SrqCnt reported with AsyncServiceRequest
+	// Message in progress on the synchronous channel, ses holds the bus
+	uint8_t inmsg, flg, nev;
+	ScpiSt t;
+	GpSes ses, aes;				// Scheduler sessions of the channels
+	// Asynchronous channel: lock request and requests waiting for the bus
+	uint8_t lkq;				// Lock requested: 1 exclusive, 2 shared
+	char lkqname[HisLkLen];
+	uint32_t lkt, lktmo;		// Time and timeout of the lock request, ms
+	uint8_t aq[HisAQ][2];		// Message type and control code
+	uint8_t an;					// Requests in aq
+	uint8_t aqd;				// The first one is queued for the bus (GpQueue)
+} His;
+
+static His HisS[HisMax];
+static SemaphoreHandle_t HisMtx;	// Session table and locks
+static uint16_t HisId=0;
+
+static void Be32(uint8_t *p, uint32_t v){
+	p[0]=v>>24; p[1]=v>>16; p[2]=v>>8; p[3]=v;
+}
+
+static uint32_t Get32(const uint8_t *p){
+	return (uint32_t)p[0]<<24|(uint32_t)p[1]<<16|(uint32_t)p[2]<<8|p[3];
+}
+
+
+//Routine waits up to ms until fd is readable. Returns 0 on timeout.
+static uint8_t HisWait(int fd, uint32_t ms){
+	fd_set fs;
+	struct timeval tv;
+	FD_ZERO(&fs);
+	FD_SET(fd,&fs);
+	tv.tv_sec=ms/1000;
+	tv.tv_usec=ms%1000*1000;
+	return select(fd+1,&fs,0,0,&tv)>0;
+}
+
+//Routine receives up to n bytes, waiting up to HisTmo. Returns number of bytes, 0 on failure.
+static uint32_t HisRecv(int fd, uint8_t *p, uint32_t n){
+	int k;
+	if(!HisWait(fd,HisTmo)) return 0;
+	k=recv(fd,p,n,0);
+	return k>0 ? k : 0;
+}
+
+//Routine receives exactly n bytes. Returns 0 on failure.
+static uint8_t HisRecvAll(int fd, uint8_t *p, uint32_t n){
+	uint32_t k;
+	while(n){
+		k=HisRecv(fd,p,n);
+		if(!k) return 0;
+		p+=k; n-=k;
+	}
+	return 1;
+}
+
+//Routine sends n bytes. Returns 0 on failure.
+static uint8_t HisSend(int fd, const uint8_t *p, uint32_t n, int flg){
+	int k;
+	while(n){
+		k=send(fd,p,n,flg);
+		if(k<=0) return 0;
+		p+=k; n-=k;
+	}
+	return 1;
+}
+
+//Routine sends message with payload p of n bytes. Returns 0 on failure.
+static uint8_t HisPut(int fd, uint8_t type, uint8_t ctl, uint32_t par, const void *p, uint32_t n){
+	uint8_t h[16]={'H','S',type,ctl};
+	Be32(h+4,par);
+	Be32(h+8,0);
+	Be32(h+12,n);
+	if(!HisSend(fd,h,16,n ? MSG_MORE : 0)) return 0;
+	return HisSend(fd,(const uint8_t *)p,n,0);
+}
+
+/*
+Routine receives message header to h. Payloads of 4 GB and more and headers
+without the prologue are fatal errors. Returns 0 on failure.
+*/
+static uint8_t HisGetHdr(int fd, HisHdr *h){
+	uint8_t b[16];
+	if(!HisRecvAll(fd,b,16)) return 0;
+	if(b[0]!='H' || b[1]!='S' || Get32(b+8)){
+		HisPut(fd,HmFatal,HeHeader,0,0,0);
+		return 0;
+	}
+	h->type=b[2];
+	h->ctl=b[3];
+	h->par=Get32(b+4);
+	h->len=Get32(b+12);
+	return 1;
+}
+
+//Routine receives payload of h to p, up to max-1 bytes with NUL added; the rest is dropped. Returns 0 on failure.
+static uint8_t HisGetPay(int fd, HisHdr *h, uint8_t *p, uint32_t max){
+	uint8_t b[64];
+	uint32_t n=h->len<max ? h->len : max-1, k;
+	if(!HisRecvAll(fd,p,n)) return 0;
+	p[n]=0;
+	for(n=h->len-n;n;n-=k){
+		k=HisRecv(fd,b,n<sizeof(b) ? n : sizeof(b));
+		if(!k) return 0;
+	}
+	return 1;
+}
+
+
+/*
+Routine returns 1 if no other session on the GPIB address of s holds a lock which
+s may not share: any for exclusive (excl set), else exclusive or other name nm.
+Caller holds HisMtx.
+*/
+static uint8_t HisLockOk(His *s, uint8_t excl, const char *nm){
+	His *o;
+	for(o=HisS;o<HisS+HisMax;o++){
+		if(o==s || !o->used || o->addr!=s->addr || !o->lk) continue;
+		if(excl || o->lk==1 || strcmp(o->lkname,nm)) return 0;
+	}
+	return 1;
+}
+
+//Routine returns 1 if s may use its device: it holds a lock or nobody holds one.
+static uint8_t HisAccess(His *s){
+	uint8_t r;
+	xSemaphoreTake(HisMtx,portMAX_DELAY);
+	r=s->lk || HisLockOk(s,1,"");
+	xSemaphoreGive(HisMtx);
+	return r;
+}
+
+
+//Routine sends n bus commands (ATN is released after them); the caller has the bus. Returns result byte.
+static uint8_t HisCmd(const uint8_t *c, uint32_t n){
+	GpEv e;
+	GpData(c,n);
+	return GpDo(GoCmd,GfRel,0,n,&e);
+}
+
+//Routine reads status byte of device a by serial poll; the caller has the bus. Returns 0 on error.
+static uint8_t HisPoll(uint8_t a){
+	const uint8_t c0[]={0x3f,0x20|HisCtl,0x18,(uint8_t)(0x40|a)}, c1[]={0x19,0x5f};	// UNL MLA SPE TAD, SPD UNT
+	GpEv e;
+	uint8_t b=0;
+	GpData(c0,sizeof(c0));
+	if(GpDo(GoCmd,GfRel,0,sizeof(c0),&e)==ACK){
+		GpDo(GoRdByte,0,0,0,&e);
+		b=RingGet(&GpRdR);
+	}
+	GpData(c1,sizeof(c1));
+	GpDo(GoCmd,GfRel,0,sizeof(c1),&e);
+	return b;
+}
+
+
+/*
+Routine reads response of the device and sends it as Data ... DataEnd with MessageID id.
+If the device does not talk, the response is an empty DataEnd.
+*/
+static void HisResp(His *s, uint32_t id){
+	GpOp o={GoRead,RdEOI,0,0,GpChunk}, st={GoStop,0,0,0,0};
+	GpEv e;
+	uint8_t *p, ev, fin=0, last=0, stop=0;
+	uint32_t n;
+	if(GpDo(GoAddr,GfTalk,s->addr,HisCtl,&e)!=ACK){
+		HisPut(s->sfd,HmDataEnd,0,id,0,0);
+		return;
+	}
+	GpPut(&o);
+	for(;;){
+		ev=GpGet(&e,0);
+		if(!ev && RingUsed(&GpRdR)<HisChunk) {GpWait(1); continue;}
+		if(ev) fin=e.res!=ACK || e.eoi || stop || e.n<o.n;
+		while((n=RingRdSpan(&GpRdR,&p))){	// Data before the event is in the ring
+			if(n>s->MaxMsg) n=s->MaxMsg;
+			last=fin && n==RingUsed(&GpRdR);
+			if(!stop && (s->clr || !HisPut(s->sfd,last ? HmDataEnd : HmData,0,id,p,n))){
+				GpPut(&st);					// Device clear or the client is gone
+				stop=1;
+				if(!s->clr) s->end=1;
+			}
+			RingSkip(&GpRdR,n);
+		}
+		if(fin || (ev && stop)) break;	// After GoStop the read is drained up to its event
+		if(!ev) continue;
+		if(s->clr) {stop=1; break;}		// Device clear, the response is dropped
+		if(GpYield(&s->ses,GcBulk) && GpDo(GoAddr,GfTalk,s->addr,HisCtl,&e)!=ACK) break;
+		GpPut(&o);						// Next part
+	}
+	if(!last && !stop && !s->clr) HisPut(s->sfd,HmDataEnd,0,id,0,0);	// No data or the read failed
+}
+
+
+/*
+Routine ends the message in progress and sends the response of a query with
+MessageID id (empty DataEnd if the message failed); if abort is set it is ended
+without EOI and there is no response. Releases the bus.
+*/
+static void HisEnd(His *s, uint32_t id, uint8_t abort){
+	GpOp o={GoWrite,0,0,0,0};
+	GpEv e;
+	uint8_t res=ACK;
+	if(abort){
+		o.flg=s->flg|GfEnd;
+		GpPut(&o);
+	}
+	for(s->nev++;s->nev;s->nev--){		// GoAddr and the message
+		while(!GpGet(&e,1000));
+		if(e.res!=ACK) res=e.res;
+	}
+	if(!abort && s->t.q && !s->clr){
+		if(res==ACK) HisResp(s,id);
+		else HisPut(s->sfd,HmDataEnd,0,id,0,0);
+	}
+	s->inmsg=0;
+	GpUnlock(&s->ses);
+}
+
+
+/*
+Routine forwards Data or DataEnd message h; the payload is received into GpWrR.
+The first one of a message takes the bus and addresses the device. Returns 0 if
+the connection failed.
+*/
+static uint8_t HisData(His *s, HisHdr *h){
+	GpOp o={GoAddr,0,s->addr,0,HisCtl};
+	uint8_t *p, d;
+	uint32_t r=h->len, k, i;
+	if(!s->inmsg){
+		while(!HisAccess(s) && !s->clr && !s->end) vTaskDelay(10);	// Locked by another session
+		if(s->clr || s->end) return HisGetPay(s->sfd,h,&d,1);	// Dropped
+		GpLock(&s->ses,GcQuery);
+		GpPut(&o);
+		s->inmsg=1;
+		s->nev=1;
+		s->flg=GfNew;
+		memset(&s->t,0,sizeof(s->t));
+	}
+	o.op=GoWrite;
+	o.arg=0;
+	o.n=0;
+	for(;;){
+		if(r){
+			k=RingWrSpan(&GpWrR,&p);
+			if(!k) {GpWait(1); continue;}	// Engine did not take data yet
+			k=HisRecv(s->sfd,p,k<r ? k : r);
+			if(!k) return 0;
+			RingWrDone(&GpWrR,k);
+			for(i=0;i<k;i+=ScpiScan(&s->t,p+i,k-i));	// '?' matters, LF does not end the message
+			r-=k;
+			o.n=k;
+		}
+		o.flg=s->flg;
+		if(!r && h->type==HmDataEnd) o.flg|=GfEnd|GfEOI;
+		if(o.n || (o.flg&GfEnd)){
+			GpPut(&o);
+			s->flg=0;
+		}
+		if(!r) break;
+	}
+	if(h->type==HmDataEnd) HisEnd(s,h->par,0);
+	return 1;
+}
+
+
+//Routine gets GPIB address from sub-address of Initialize, def if there is none.
+static uint8_t HisSub(const char *sub, uint8_t def){
+	int a=0;
+	if(!strncmp(sub,"gpib0,",6)) a=atoi(sub+6);
+	else if(!strncmp(sub,"hislip",6)) a=atoi(sub+6);
+	return a>0 && a<31 ? a : def;
+}
+
+
+//Routine runs synchronous channel of a new session; h is Initialize.
+static void HisSync(int fd, HisHdr *h, uint8_t addr){
+	const uint8_t get[]={0x3f,0x40|HisCtl,0,0x08};	// UNL MTA LAD GET
+	uint8_t sub[32], c[4];
+	His *s=0, *o;
+	HisHdr m;
+	if(!HisGetPay(fd,h,sub,sizeof(sub))) return;
+	xSemaphoreTake(HisMtx,portMAX_DELAY);
+	for(o=HisS;o<HisS+HisMax;o++) if(!o->used) {s=o; break;}
+	if(s){
+		memset(s,0,sizeof(His));
+		s->used=1;
+		s->id=++HisId;
+		s->addr=HisSub((char *)sub,addr);
+		s->sfd=fd;
+		s->overlap=HisOverlap;
+		s->MaxMsg=0xffffffff;
+		s->SrqSeen=SrqCnt;
+	}
+	xSemaphoreGive(HisMtx);
+	if(!s){
+		HisPut(fd,HmFatal,HeMaxCli,0,0,0);
+		return;
+	}
+	GpSesInit(&s->ses,1);
+	s->ses.dev=GpDev(s->addr);
+	HisPut(fd,HmInitResp,s->overlap,(uint32_t)HisVer<<16|s->id,0,0);
+	while(!s->end){
+		if(!HisWait(fd,100)){
+			if(s->inmsg && s->clr) HisEnd(s,0,1);	// Device clear in the middle of a message
+			continue;
+		}
+		if(!HisGetHdr(fd,&m)) break;
+		if(m.type!=HmData && m.type!=HmDataEnd && s->inmsg) HisEnd(s,0,1);
+		switch(m.type){
+			case HmData:
+			case HmDataEnd:
+				if(!HisData(s,&m)) s->end=1;
+				break;
+			case HmTrigger:
+				if(!HisGetPay(fd,&m,c,1)) s->end=1;
+				else if(!s->clr){
+					memcpy(c,get,sizeof(c));
+					c[2]=0x20|s->addr;
+					while(!HisAccess(s) && !s->clr && !s->end) vTaskDelay(10);
+					GpLock(&s->ses,GcQuery);
+					HisCmd(c,sizeof(c));
+					GpUnlock(&s->ses);
+				}
+				break;
+			case HmClrDone:					// Feature request: overlapped mode
+				if(!HisGetPay(fd,&m,c,1)) s->end=1;
+				s->overlap=m.ctl&1;
+				s->clr=0;
+				HisPut(fd,HmClrAck,s->overlap,0,0,0);
+				break;
+			default:
+				if(!HisGetPay(fd,&m,c,1)) s->end=1;
+				HisPut(fd,HmError,HeType,0,0,0);
+		}
+	}
+	if(s->inmsg) HisEnd(s,0,1);
+	GpSesEnd(&s->ses);
+	xSemaphoreTake(HisMtx,portMAX_DELAY);
+	s->end=1;
+	s->lk=0;
+	s->used&=~1;
+	xSemaphoreGive(HisMtx);
+}
+
+
+//Routine grants the lock request of s if it can, or refuses it after its timeout.
+static void HisLockChk(His *s, int fd){
+	uint8_t r=0;
+	if(!s->lkq) return;
+	xSemaphoreTake(HisMtx,portMAX_DELAY);
+	if(HisLockOk(s,s->lkq==1,s->lkqname)){
+		s->lk=s->lkq;
+		strcpy(s->lkname,s->lkqname);
+		r=1;
+	}
+	xSemaphoreGive(HisMtx);
+	if(!r && millis()-s->lkt<s->lktmo) return;
+	s->lkq=0;
+	HisPut(fd,HmLockResp,r,0,0,0);
+}
+
+//Routine handles AsyncLock h of session s; a request waits in HisLockChk up to its timeout.
+static void HisLock(His *s, int fd, HisHdr *h){
+	uint8_t nm[HisLkLen], r;
+	if(!HisGetPay(fd,h,nm,sizeof(nm))) {s->end=1; return;}
+	if(!h->ctl){						// Release
+		xSemaphoreTake(HisMtx,portMAX_DELAY);
+		r=s->lk ? s->lk : 3;
+		s->lk=0;
+		xSemaphoreGive(HisMtx);
+		HisPut(fd,HmLockResp,r,0,0,0);
+		return;
+	}
+	if(s->lk || s->lkq){				// Error: lock held or requested already
+		HisPut(fd,HmLockResp,3,0,0,0);
+		return;
+	}
+	s->lkq=h->len ? 2 : 1;				// Request; par is timeout, ms
+	strcpy(s->lkqname,(char *)nm);
+	s->lkt=millis();
+	s->lktmo=h->par;
+	HisLockChk(s,fd);
+}
+
+//Routine handles AsyncLockInfo: control code is 1 if an exclusive lock is held, parameter the number of holders.
+static void HisLockInfo(His *s, int fd){
+	His *o;
+	uint8_t x=0;
+	uint32_t n=0;
+	xSemaphoreTake(HisMtx,portMAX_DELAY);
+	for(o=HisS;o<HisS+HisMax;o++){
+		if(!o->used || o->addr!=s->addr || !o->lk) continue;
+		n++;
+		if(o->lk==1) x=1;
+	}
+	xSemaphoreGive(HisMtx);
+	HisPut(fd,HmLockInfoResp,x,n,0,0);
+}
+
+//Routine handles AsyncRemoteLocalControl request r (0-6 of IVI-6.1); the caller has the bus.
+static void HisRemote(His *s, uint8_t r){
+	uint8_t c[5]={0x3f,0x40|HisCtl,(uint8_t)(0x20|s->addr)}, n=3;	// UNL MTA LAD
+	GpOp o={GoRen,0,1,0,0};
+	if(r==0 || r==2) o.arg=0;			// REN false
+	if(r<=5) GpPut(&o);
+	if(r==4) n=0;						// LLO only
+	if(r==4 || r==5) c[n++]=0x11;		// LLO
+	else if(r==6) c[n++]=0x01;			// GTL
+	else if(r!=3) n=0;
+	if(n) HisCmd(c,n);
+}
+
+
+/*
+Routine runs the first request of the asynchronous channel which needs the bus
+(AsyncRemoteLocalControl, AsyncDeviceClear, AsyncStatusQuery) and sends its
+response. It queues the session for the bus first. Returns 0 while it waits.
+*/
+static uint8_t HisBus(His *s, int fd){
+	uint8_t t=s->aq[0][0], c[4];
+	if(!s->aqd){
+		GpQueue(&s->aes,t==HmRemote ? GcQuery : GcSrq);
+		s->aqd=1;
+	}
+	if(!s->aes.grant) return 0;
+	switch(t){
+		case HmRemote:
+			HisRemote(s,s->aq[0][1]);
+			GpUnlock(&s->aes);
+			HisPut(fd,HmRemoteResp,0,0,0,0);
+			break;
+		case HmAClear:
+			c[0]=0x3f; c[1]=0x40|HisCtl; c[2]=0x20|s->addr; c[3]=0x04;	// UNL MTA LAD SDC
+			HisCmd(c,4);
+			GpUnlock(&s->aes);
+			HisPut(fd,HmAClearAck,HisOverlap,0,0,0);
+			break;
+		case HmStatus:
+			c[0]=HisPoll(s->addr);
+			GpUnlock(&s->aes);
+			HisPut(fd,HmStatusResp,c[0],0,0,0);
+			break;
+	}
+	s->aqd=0;
+	s->an--;
+	memmove(s->aq,s->aq+1,s->an*sizeof(s->aq[0]));
+	return 1;
+}
+
+
+//Routine runs asynchronous channel; h is AsyncInitialize with the session ID.
+static void HisAsync(int fd, HisHdr *h){
+	uint8_t c[9];
+	His *s=0, *o;
+	HisHdr m;
+	uint32_t k;
+	if(!HisGetPay(fd,h,c,1)) return;
+	xSemaphoreTake(HisMtx,portMAX_DELAY);
+	for(o=HisS;o<HisS+HisMax;o++) if(o->used==1 && o->id==(h->par&0xffff)) {s=o; break;}
+	if(s) s->used|=2;
+	xSemaphoreGive(HisMtx);
+	if(!s){
+		HisPut(fd,HmFatal,HeInit,0,0,0);
+		return;
+	}
+	GpSesInit(&s->aes,1);
+	s->aes.dev=GpDev(s->addr);
+	HisPut(fd,HmAInitResp,0,HisVendor,0,0);
+	while(!s->end){
+		k=SrqCnt;
+		if(k!=s->SrqSeen){
+			s->SrqSeen=k;
+			if(SrqLine && !HisPut(fd,HmSrq,0,0,0,0)) break;
+		}
+		HisLockChk(s,fd);
+		if(s->an && HisBus(s,fd)) continue;
+		if(s->an==HisAQ) {vTaskDelay(1); continue;}	// Queue is full, messages wait
+		if(!HisWait(fd,s->an || s->lkq ? 1 : 10)) continue;
+		if(!HisGetHdr(fd,&m)) break;
+		if(m.type!=HmMaxSize && m.type!=HmLock && !HisGetPay(fd,&m,c,1)) break;
+		switch(m.type){
+			case HmMaxSize:					// Payload: largest message of the client, 8 bytes
+				memset(c,0,sizeof(c));
+				if(!HisGetPay(fd,&m,c,sizeof(c))) s->end=1;		// NUL is added
+				s->MaxMsg=Get32(c) ? 0xffffffff : Get32(c+4);
+				if(!s->MaxMsg) s->MaxMsg=1;
+				Be32(c,0);
+				Be32(c+4,0xffffffff);		// Data is forwarded as it comes
+				HisPut(fd,HmMaxSizeResp,0,0,c,8);
+				break;
+			case HmLock:
+				HisLock(s,fd,&m);
+				break;
+			case HmLockInfo:
+				HisLockInfo(s,fd);
+				break;
+			case HmAClear:
+				s->clr=1;
+				GpStop(&s->ses);			// Read of the synchronous channel
+				/* fall through */
+			case HmRemote:
+			case HmStatus:
+				s->aq[s->an][0]=m.type;
+				s->aq[s->an++][1]=m.ctl;
+				break;
+			default:
+				HisPut(fd,HmError,HeType,0,0,0);
+		}
+	}
+	if(s->aqd){							// Queued for the bus
+		while(!s->aes.grant) GpWait(10);
+		GpUnlock(&s->aes);
+	}
+	GpSesEnd(&s->aes);
+	xSemaphoreTake(HisMtx,portMAX_DELAY);
+	s->end=1;
+	s->used&=~2;
+	xSemaphoreGive(HisMtx);
+}
+
+
+void HisInit(void){
+	HisMtx=xSemaphoreCreateMutex();
+}
+
+
+/*
+Routine runs a HiSLIP connection fd until it is closed; addr is the GPIB address
+of sessions without one in the sub-address.
+*/
+void HisRun(int fd, uint8_t addr){
+	HisHdr h;
+	int on=1;
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+	setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,&on,sizeof(on));
+	if(!HisGetHdr(fd,&h)) return;
+	if(h.type==HmInit) HisSync(fd,&h,addr);
+	else if(h.type==HmAInit) HisAsync(fd,&h);
+	else HisPut(fd,HmFatal,HeInit,0,0,0);
+}
@@ -0,0 +1,14 @@
+/*
+HiSLIP session of WGPIB firmware (IVI-6.1, protocol version 1.0).
+Both channels of a session are connections to the same TCP port; each runs HisRun.
+*/
+
+#ifndef HISLIP_H
+#define HISLIP_H
+
+#include <stdint.h>
+
+void HisInit(void);
+void HisRun(int fd, uint8_t addr);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+Host build of WGPIB firmware with the simulated bus (GpSim, see gpib.cpp), for
+tests of the host links on Linux without an ESP32 and instruments. The services
+run as in WGPIB.ino, on ports HostOfs above the ones of the adapter:
+	15000		BSC protocol on TCP, one connection at a time
+	15001		UART (BSC protocol), a TCP connection stands for the line
+	15025...	raw socket of GPIB address ScpiAddr and next ones
+	14880		HiSLIP, sub-address hislip0 is HisAddr
+	15030		UDP streaming
+	14999		SRQ line: a connection sends '1' to assert it, '0' to release it
+Build with make, the tests (test*.py) run against it: make test.
+*/
+
+#include <Arduino.h>
+#include <signal.h>
+#include <lwip/sockets.h>
+#include <netinet/tcp.h>
+#include "gpib.h"
+#include "link.h"
+#include "bsc.h"
+#include "scpi.h"
+#include "hislip.h"
+#include "udp.h"
+#include "soc/gpio_reg.h"
+#include "posix.h"
+
+// Settings, as in WGPIB.ino
+#define HostOfs 10000			// Ports above the ones of the adapter
+#define UartBaud 115200
+#define BscPort 5000
+#define UartPort 5001
+#define ScpiPort 5025
+#define ScpiAddr 1
+#define ScpiCnt 4
+#define HisPort 4880
+#define HisAddr 1
+#define UdpPort 5030
+#define SrqPort 4999
+
+static Link UartLnk, TcpLnk;
+
+
+//Routine opens listening socket on port; it waits until it can.
+static int Listen(uint16_t port){
+	int srv;
+	while((srv=TcpListen(port+HostOfs))<0) vTaskDelay(1000);
+	return srv;
+}
+
+
+//Task runs BSC protocol on the UART.
+static void UartTask(void *arg){
+	HostUartSrv=Listen(UartPort);
+	LnkUartBegin(UartBaud);
+	LnkInit(&UartLnk,LnkUart);
+	for(;;) BscRun(&UartLnk);
+}
+
+
+//Task runs BSC protocol on TCP connections, one at a time.
+static void TcpTask(void *arg){
+	int srv=Listen(BscPort), fd, on=1;
+	for(;;){
+		fd=accept(srv,0,0);
+		if(fd<0) continue;
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+		LnkInit(&TcpLnk,fd);
+		BscRun(&TcpLnk);
+		close(fd);
+	}
+}
+
+
+//Task runs raw socket session of one connection; arg is socket<<8 | GPIB address.
+static void ScpiConn(void *arg){
+	int fd=(intptr_t)arg>>8;
+	ScpiRun(fd,(intptr_t)arg&0xff);
+	close(fd);
+	vTaskDelete(NULL);
+}
+
+//Task accepts raw socket connections on ScpiCnt ports.
+static void ScpiTask(void *arg){
+	int srv[ScpiCnt], fd, i, m;
+	fd_set fs;
+	for(i=0;i<ScpiCnt;i++) srv[i]=Listen(ScpiPort+i);
+	for(;;){
+		FD_ZERO(&fs);
+		for(i=m=0;i<ScpiCnt;i++){
+			FD_SET(srv[i],&fs);
+			if(srv[i]>m) m=srv[i];
+		}
+		if(select(m+1,&fs,0,0,0)<=0) continue;
+		for(i=0;i<ScpiCnt;i++){
+			if(!FD_ISSET(srv[i],&fs)) continue;
+			fd=accept(srv[i],0,0);
+			if(fd<0) continue;
+			if(xTaskCreatePinnedToCore(ScpiConn,"scpi",4096,(void *)(intptr_t)(fd<<8|(ScpiAddr+i)),2,0,0)!=pdPASS) close(fd);
+		}
+	}
+}
+
+
+//Task runs one HiSLIP connection; arg is the socket.
+static void HisConn(void *arg){
+	int fd=(intptr_t)arg;
+	HisRun(fd,HisAddr);
+	close(fd);
+	vTaskDelete(NULL);
+}
+
+//Task accepts HiSLIP connections.
+static void HisTask(void *arg){
+	int srv, fd;
+	HisInit();
+	srv=Listen(HisPort);
+	for(;;){
+		fd=accept(srv,0,0);
+		if(fd<0) continue;
+		if(xTaskCreatePinnedToCore(HisConn,"hislip",4096,(void *)(intptr_t)fd,2,0,0)!=pdPASS) close(fd);
+	}
+}
+
+
+//Task runs UDP streaming.
+static void UdpTask(void *arg){
+	UdpRun(UdpPort+HostOfs);
+}
+
+
+//Task sets the SRQ line (active low, as read by the engine) by requests of the tests.
+static void SrqTask(void *arg){
+	int srv=Listen(SrqPort), fd;
+	char c;
+	for(;;){
+		fd=accept(srv,0,0);
+		if(fd<0) continue;
+		if(recv(fd,&c,1,0)==1){
+			if(c=='1') REG_WRITE(GPIO_IN_REG,REG_READ(GPIO_IN_REG)&~(1UL<<PinSRQ));
+			else REG_WRITE(GPIO_IN_REG,REG_READ(GPIO_IN_REG)|1UL<<PinSRQ);
+		}
+		close(fd);
+	}
+}
+
+
+int main(void){
+	signal(SIGPIPE,SIG_IGN);			// Send to a closed connection fails, as in lwIP
+	REG_WRITE(GPIO_IN_REG,0xffffffff);	// Lines released
+	GpBegin();
+	xTaskCreatePinnedToCore(UartTask,"uart",8192,0,2,0,0);
+	xTaskCreatePinnedToCore(TcpTask,"tcp",8192,0,2,0,0);
+	xTaskCreatePinnedToCore(ScpiTask,"scpisrv",4096,0,2,0,0);
+	xTaskCreatePinnedToCore(HisTask,"hissrv",4096,0,2,0,0);
+	xTaskCreatePinnedToCore(UdpTask,"udp",6144,0,2,0,0);
+	SrqTask(0);
+	return 0;
+}
@@ -0,0 +1,236 @@
+/*
+POSIX stand-in of the ESP32 platform for the host build of WGPIB firmware (see
+main.cpp). A task is a thread; its notification value is a counter guarded by
+a mutex, as in FreeRTOS. Core numbers and priorities are ignored, so the engine
+does not run alone on a core and bus timing is not real; the scheduler and the
+rings are the same code as on the ESP32.
+*/
+
+#include <Arduino.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <lwip/sockets.h>
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "driver/uart.h"
+#include "soc/gpio_reg.h"
+#include "posix.h"
+
+typedef struct{
+	pthread_mutex_t m;
+	pthread_cond_t c;
+	uint32_t n;					// Notification value
+	void (*f)(void *);
+	void *arg;
+} Task;
+
+volatile uint32_t HostReg[64];
+int HostUartSrv=-1;
+static int HostUart=-1;			// Connection of the UART
+static uint32_t HostBaud;
+static __thread Task *Cur;		// Task of the thread
+
+
+static uint64_t Us(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec*1000000ULL+t.tv_nsec/1000;
+}
+
+static Task *TaskNew(void){
+	Task *t=(Task *)calloc(1,sizeof(Task));
+	pthread_mutex_init(&t->m,0);
+	pthread_cond_init(&t->c,0);
+	return t;
+}
+
+//Routine returns task of the calling thread; threads not created by xTaskCreatePinnedToCore get one too.
+static Task *Self(void){
+	if(!Cur) Cur=TaskNew();
+	return Cur;
+}
+
+static void *TaskRun(void *arg){
+	Cur=(Task *)arg;
+	Cur->f(Cur->arg);
+	return 0;
+}
+
+
+int64_t esp_timer_get_time(void){
+	return Us();
+}
+
+uint32_t millis(void){
+	return Us()/1000;
+}
+
+void delayMicroseconds(uint32_t us){
+	usleep(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode){
+}
+
+bool psramFound(void){
+	return true;
+}
+
+void *ps_malloc(size_t n){
+	return malloc(n);
+}
+
+
+BaseType_t xTaskCreatePinnedToCore(void (*f)(void *), const char *name, uint32_t stack, void *arg, int prio, TaskHandle_t *h, int core){
+	Task *t=TaskNew();
+	pthread_t p;
+	t->f=f;
+	t->arg=arg;
+	if(h) *h=t;
+	if(pthread_create(&p,0,TaskRun,t)) return pdFALSE;
+	pthread_detach(p);
+	return pdPASS;
+}
+
+//Routine ends the calling task; h has to be it (or NULL).
+void vTaskDelete(TaskHandle_t h){
+	pthread_exit(0);
+}
+
+void vTaskDelay(TickType_t t){
+	usleep(t*1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void){
+	return Self();
+}
+
+TickType_t xTaskGetTickCount(void){
+	return millis();
+}
+
+void xTaskNotifyGive(TaskHandle_t h){
+	Task *t=(Task *)h;
+	pthread_mutex_lock(&t->m);
+	t->n++;
+	pthread_cond_signal(&t->c);
+	pthread_mutex_unlock(&t->m);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clr, TickType_t ms){
+	Task *t=Self();
+	struct timespec ts;
+	uint64_t ns;
+	uint32_t n;
+	pthread_mutex_lock(&t->m);
+	if(!t->n && ms==portMAX_DELAY) while(!t->n) pthread_cond_wait(&t->c,&t->m);
+	else if(!t->n && ms){
+		clock_gettime(CLOCK_REALTIME,&ts);
+		ns=ts.tv_nsec+(uint64_t)ms*1000000;
+		ts.tv_sec+=ns/1000000000;
+		ts.tv_nsec=ns%1000000000;
+		while(!t->n && pthread_cond_timedwait(&t->c,&t->m,&ts)!=ETIMEDOUT);
+	}
+	n=t->n;
+	if(clr) t->n=0;
+	else if(n) t->n--;
+	pthread_mutex_unlock(&t->m);
+	return n;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void){
+	pthread_mutex_t *m=(pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(m,0);
+	return m;
+}
+
+//Routine takes mutex m; the firmware waits with portMAX_DELAY only.
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t t){
+	pthread_mutex_lock((pthread_mutex_t *)m);
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m){
+	pthread_mutex_unlock((pthread_mutex_t *)m);
+	return pdTRUE;
+}
+
+
+/*
+UART: a connection accepted on HostUartSrv, one at a time. While there is none,
+nothing is received and written data is dropped.
+*/
+
+//Routine waits up to ms until the UART connection is readable. Returns 0 on timeout.
+static uint8_t UartWait(uint32_t ms){
+	struct pollfd p;
+	if(HostUart<0){
+		if(HostUartSrv<0){
+			usleep(ms*1000);
+			return 0;
+		}
+		p.fd=HostUartSrv;
+		p.events=POLLIN;
+		if(poll(&p,1,ms)<=0) return 0;
+		HostUart=accept(HostUartSrv,0,0);
+		return 0;
+	}
+	p.fd=HostUart;
+	p.events=POLLIN;
+	return poll(&p,1,ms)>0;
+}
+
+int uart_read_bytes(uart_port_t u, void *p, uint32_t n, uint32_t t){
+	int k;
+	if(!UartWait(t)) return 0;
+	k=recv(HostUart,p,n,MSG_DONTWAIT);
+	if(k==0 || (k<0 && errno!=EAGAIN)){			// Closed, wait for the next one
+		close(HostUart);
+		HostUart=-1;
+		return 0;
+	}
+	return k<0 ? 0 : k;
+}
+
+int uart_write_bytes(uart_port_t u, const void *p, size_t n){
+	if(HostUart>=0) send(HostUart,p,n,MSG_NOSIGNAL);
+	return n;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t u, size_t *n){
+	int k=0;
+	if(HostUart>=0) ioctl(HostUart,FIONREAD,&k);
+	*n=k;
+	return 0;
+}
+
+esp_err_t uart_flush_input(uart_port_t u){
+	uint8_t b[256];
+	if(HostUart>=0) while(recv(HostUart,b,sizeof(b),MSG_DONTWAIT)>0);
+	return 0;
+}
+
+esp_err_t uart_param_config(uart_port_t u, const uart_config_t *c){
+	HostBaud=c->baud_rate;
+	return 0;
+}
+
+esp_err_t uart_set_baudrate(uart_port_t u, uint32_t b){
+	HostBaud=b;
+	return 0;
+}
+
+esp_err_t uart_get_baudrate(uart_port_t u, uint32_t *b){
+	*b=HostBaud;
+	return 0;
+}
+
+esp_err_t uart_set_pin(uart_port_t u, int tx, int rx, int rts, int cts){return 0;}
+esp_err_t uart_driver_install(uart_port_t u, int rx, int tx, int qn, void *q, int flg){return 0;}
+esp_err_t uart_set_rx_full_threshold(uart_port_t u, int n){return 0;}
+esp_err_t uart_set_tx_empty_threshold(uart_port_t u, int n){return 0;}
+esp_err_t uart_set_rx_timeout(uart_port_t u, uint8_t n){return 0;}
+esp_err_t uart_wait_tx_done(uart_port_t u, uint32_t t){return 0;}
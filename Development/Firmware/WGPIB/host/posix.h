@@ -0,0 +1,15 @@
+/*
+POSIX stand-in of the ESP32 platform for the host build of WGPIB firmware.
+The headers of Arduino, FreeRTOS, lwIP and ESP-IDF which the firmware includes
+are in stub/, the calls are in posix.cpp.
+*/
+
+#ifndef POSIX_H
+#define POSIX_H
+
+#include <stdint.h>
+
+extern volatile uint32_t HostReg[64];	// GPIO registers
+extern int HostUartSrv;					// Listening socket of the UART; -1: no UART
+
+#endif
@@ -0,0 +1,60 @@
+"""
+Runs the tests of the host build (test*.py) against a new sim; used by make test.
+Each test is a program which exits with 0 if all its checks passed; a report
+of the sanitizers in the output of the sim (sim.log) fails the run too.
+Usage: python3 run.py [<test> ...]
+"""
+
+import glob
+import os
+import socket
+import subprocess
+import sys
+import time
+
+import simtest
+
+
+def wait_sim(p, tmo=10):
+    """Waits until the sim accepts connections; returns 0 if it ended or did not start."""
+    t = time.time()
+    while time.time() - t < tmo:
+        if p.poll() is not None:
+            return 0
+        try:
+            socket.create_connection((simtest.HOST, simtest.BSC_PORT)).close()
+            return 1
+        except OSError:
+            time.sleep(0.1)
+    return 0
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    tests = sys.argv[1:] or sorted(glob.glob(os.path.join(here, "test*.py")))
+    with open(os.path.join(here, "sim.log"), "w") as log:
+        p = subprocess.Popen([os.path.join(here, "sim")], stdout=log, stderr=subprocess.STDOUT)
+    failed = []
+    try:
+        if not wait_sim(p):
+            sys.exit("sim did not start, see sim.log")
+        time.sleep(0.2)                         # Other servers of the sim
+        for t in tests:
+            print("== " + os.path.basename(t))
+            if subprocess.call([sys.executable, t], cwd=here, timeout=300):
+                failed.append(os.path.basename(t))
+            if p.poll() is not None:
+                failed.append("sim ended, see sim.log")
+                break
+    finally:
+        p.kill()
+        p.wait()
+    with open(os.path.join(here, "sim.log")) as log:
+        if any("Sanitizer" in x or "runtime error" in x for x in log):
+            failed.append("sanitizer report in sim.log")
+    print("failed: " + ", ".join(failed) if failed else "all tests passed")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
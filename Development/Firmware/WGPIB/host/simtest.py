@@ -0,0 +1,175 @@
+"""
+Common parts of the tests of the host build of WGPIB firmware (main.cpp).
+The tests run against a running sim: make test starts it and runs them (run.py);
+a test can also be run alone while ./sim runs, e.g. python3 test_scpi.py.
+
+The simulated bus (GpSim, gpib.cpp) has devices at addresses 1-29; a device
+returns the last message written to it, "WGPIB,SIM,<address>,0\n" after *IDN?
+and n digits and LF after DATA? <n>; after HANG? it does not talk, the read waits
+until it is stopped or times out. There is no device at address NONE.
+"""
+
+import socket
+import struct
+import zlib
+
+HOST = "127.0.0.1"
+BSC_PORT = 15000
+UART_PORT = 15001
+SCPI_PORT = 15025       # GPIB address 1, next ports next addresses
+HIS_PORT = 14880
+UDP_PORT = 15030
+SRQ_PORT = 14999
+NONE = 30               # GPIB address without device (SimNone)
+
+STX, ETX, ACK, DLE, NAK, ESC = 0x02, 0x03, 0x06, 0x10, 0x15, 0x1B
+UNL, UNT = 0x3F, 0x5F
+LF_LAST, LF_SYNC = 0x01, 0x02
+
+
+def check(name, ok):
+    print("%-50s %s" % (name, "ok" if ok else "FAILED"))
+    return bool(ok)
+
+
+def digits(n):
+    """Returns the response of the simulated device to DATA? n."""
+    return bytes(ord("0") + i % 10 for i in range(n)) + b"\n"
+
+
+def srq(on):
+    """Asserts (on) or releases the SRQ line of the simulated bus."""
+    with socket.create_connection((HOST, SRQ_PORT)) as s:
+        s.sendall(b"1" if on else b"0")
+
+
+def cobs_encode(b):
+    out = bytearray()
+    blk = bytearray()
+    for x in b:
+        if x == 0:
+            out.append(len(blk) + 1)
+            out += blk
+            blk = bytearray()
+            continue
+        blk.append(x)
+        if len(blk) == 254:
+            out.append(255)
+            out += blk
+            blk = bytearray()
+    out.append(len(blk) + 1)
+    out += blk
+    return bytes(out)
+
+
+def cobs_decode(e):
+    out = bytearray()
+    i = 0
+    code = 0xFF
+    while i < len(e):
+        if code < 0xFF:
+            out.append(0)
+        code = e[i]
+        out += e[i + 1:i + code]
+        i += code
+    return bytes(out)
+
+
+def frame(data, flg):
+    """Returns COBS frame of data with flags flg, ended by zero (link.h)."""
+    b = data + bytes([flg])
+    return cobs_encode(b + struct.pack("<I", zlib.crc32(b))) + b"\0"
+
+
+class Bsc:
+    """Client of BSC protocol on TCP port (BSC_PORT, or UART_PORT for the UART)."""
+
+    def __init__(self, port=BSC_PORT, tmo=10):
+        self.s = socket.create_connection((HOST, port))
+        self.s.settimeout(tmo)
+        self.buf = b""
+
+    def close(self):
+        self.s.close()
+
+    def send(self, b):
+        self.s.sendall(b)
+
+    def read(self, n):
+        while len(self.buf) < n:
+            d = self.s.recv(65536)
+            if not d:
+                raise EOFError("connection closed")
+            self.buf += d
+        r, self.buf = self.buf[:n], self.buf[n:]
+        return r
+
+    def res(self):
+        """Returns the next return byte."""
+        return self.read(1)[0]
+
+    def cmd(self, c):
+        """Sends command IB<c> ended by CR."""
+        self.send(b"IB" + c + b"\r")
+
+    def bus(self, *cmds):
+        """Sends bus commands with IBC; returns 1 if all returned ACK."""
+        ok = True
+        for c in cmds:
+            self.send(b"IBC" + bytes([c]) + b"\r")
+            ok &= self.res() == ACK
+        return ok
+
+    def talk(self, a):
+        """Addresses device a to talk, the controller (0) to listen."""
+        return self.bus(UNL, 0x20, 0x40 | a)
+
+    def listen(self, a):
+        """Addresses device a to listen, the controller (0) to talk."""
+        return self.bus(UNL, 0x40, 0x20 | a)
+
+    def write(self, msg, frm=False):
+        """Writes msg to the addressed listener as a data block; returns the result byte."""
+        if frm:
+            self.send(b"IB" + bytes([DLE, STX]) + frame(msg, LF_LAST))
+        else:
+            self.send(b"IB" + bytes([DLE, STX]) + msg.replace(b"\x10", b"\x10\x10") + bytes([DLE, ETX]))
+        return self.res()
+
+    def block(self):
+        """Reads a data block <DLE><STX> ... <DLE><ETX>; returns its data."""
+        if self.read(2) != bytes([DLE, STX]):
+            raise ValueError("no data block")
+        out = bytearray()
+        while True:
+            c = self.read(1)[0]
+            if c == DLE:
+                c = self.read(1)[0]
+                if c == ETX:
+                    return bytes(out)
+            out.append(c)
+
+    def frames(self):
+        """Reads COBS frames up to the one with LF_LAST; returns the data and number of frames."""
+        data = b""
+        n = 0
+        while True:
+            while b"\0" not in self.buf:
+                self.buf += self.s.recv(65536)
+            i = self.buf.index(b"\0")
+            d = cobs_decode(self.buf[:i])
+            self.buf = self.buf[i + 1:]
+            if zlib.crc32(d[:-4]) != struct.unpack("<I", d[-4:])[0]:
+                raise ValueError("frame CRC")
+            data += d[:-5]
+            n += 1
+            if d[-5] & LF_LAST:
+                return data, n
+
+    def query(self, a, msg, frm=False):
+        """Writes msg to device a, reads its response (IB?); returns data and result byte."""
+        if not self.listen(a) or self.write(msg, frm) != ACK or not self.talk(a):
+            return None, None
+        self.cmd(b"?")
+        d = self.frames()[0] if frm else self.block()
+        return d, self.res()
@@ -0,0 +1,28 @@
+/*
+Arduino core of ESP32 for the host build (see ../posix.cpp): the calls which the
+firmware uses, on POSIX.
+*/
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define INPUT 1
+#define OUTPUT 3
+
+void pinMode(uint8_t pin, uint8_t mode);
+uint32_t millis(void);
+void delayMicroseconds(uint32_t us);
+bool psramFound(void);
+void *ps_malloc(size_t n);
+
+#endif
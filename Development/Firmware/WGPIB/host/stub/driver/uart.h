@@ -0,0 +1,43 @@
+/*
+ESP-IDF UART driver for the host build (see ../../posix.cpp). The UART is a TCP
+connection of the sim (HostUartSrv); the rate is only kept.
+*/
+
+#ifndef DRIVER_UART_H
+#define DRIVER_UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int uart_port_t;
+typedef int esp_err_t;
+
+#define UART_NUM_0 0
+#define UART_PIN_NO_CHANGE (-1)
+enum {UART_DATA_8_BITS=3};
+enum {UART_PARITY_DISABLE=0};
+enum {UART_STOP_BITS_1=1};
+enum {UART_HW_FLOWCTRL_DISABLE=0, UART_HW_FLOWCTRL_CTS_RTS=3};
+enum {UART_SCLK_APB=0};
+
+typedef struct{
+	int baud_rate, data_bits, parity, stop_bits, flow_ctrl;
+	uint8_t rx_flow_ctrl_thresh;
+	int source_clk;
+} uart_config_t;
+
+esp_err_t uart_param_config(uart_port_t u, const uart_config_t *c);
+esp_err_t uart_set_pin(uart_port_t u, int tx, int rx, int rts, int cts);
+esp_err_t uart_driver_install(uart_port_t u, int rx, int tx, int qn, void *q, int flg);
+esp_err_t uart_set_rx_full_threshold(uart_port_t u, int n);
+esp_err_t uart_set_tx_empty_threshold(uart_port_t u, int n);
+esp_err_t uart_set_rx_timeout(uart_port_t u, uint8_t n);
+int uart_read_bytes(uart_port_t u, void *p, uint32_t n, uint32_t t);
+int uart_write_bytes(uart_port_t u, const void *p, size_t n);
+esp_err_t uart_get_buffered_data_len(uart_port_t u, size_t *n);
+esp_err_t uart_wait_tx_done(uart_port_t u, uint32_t t);
+esp_err_t uart_set_baudrate(uart_port_t u, uint32_t b);
+esp_err_t uart_get_baudrate(uart_port_t u, uint32_t *b);
+esp_err_t uart_flush_input(uart_port_t u);
+
+#endif
@@ -0,0 +1,10 @@
+// ESP-IDF timer for the host build (see ../posix.cpp)
+
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif
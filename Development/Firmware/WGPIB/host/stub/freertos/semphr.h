@@ -0,0 +1,14 @@
+// FreeRTOS mutex for the host build (see ../../posix.cpp)
+
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include "FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m);
+
+#endif
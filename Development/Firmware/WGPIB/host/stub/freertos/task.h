@@ -0,0 +1,16 @@
+// FreeRTOS tasks and notifications for the host build: a task is a thread (see ../../posix.cpp)
+
+#ifndef TASK_H
+#define TASK_H
+
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(void (*f)(void *), const char *name, uint32_t stack, void *arg, int prio, TaskHandle_t *h, int core);
+void vTaskDelete(TaskHandle_t h);
+void vTaskDelay(TickType_t t);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t xTaskGetTickCount(void);
+void xTaskNotifyGive(TaskHandle_t h);
+uint32_t ulTaskNotifyTake(BaseType_t clr, TickType_t t);
+
+#endif
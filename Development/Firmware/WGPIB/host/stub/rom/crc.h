@@ -0,0 +1,18 @@
+// CRC-32 of ESP32 ROM for the host build (IEEE 802.3, reflected, as crc32_le of the ROM)
+
+#ifndef ROM_CRC_H
+#define ROM_CRC_H
+
+#include <stdint.h>
+
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *p, uint32_t n){
+	uint8_t i;
+	crc=~crc;
+	while(n--){
+		crc^=*p++;
+		for(i=0;i<8;i++) crc=crc>>1^(0xEDB88320&-(crc&1));
+	}
+	return ~crc;
+}
+
+#endif
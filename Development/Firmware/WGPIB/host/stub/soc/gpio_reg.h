@@ -0,0 +1,28 @@
+/*
+GPIO registers of ESP32 for the host build: an array (HostReg, ../../posix.cpp).
+With the simulated bus only the SRQ input is used; the sim sets it (main.cpp).
+*/
+
+#ifndef SOC_GPIO_REG_H
+#define SOC_GPIO_REG_H
+
+#include <stdint.h>
+
+extern volatile uint32_t HostReg[64];
+
+#define DR_REG_GPIO_BASE 0x3ff44000
+#define REG_WRITE(r,v) (HostReg[((r)-DR_REG_GPIO_BASE)/4]=(v))
+#define REG_READ(r) (HostReg[((r)-DR_REG_GPIO_BASE)/4])
+
+#define GPIO_OUT_W1TS_REG 0x3ff44008
+#define GPIO_OUT_W1TC_REG 0x3ff4400c
+#define GPIO_OUT1_W1TS_REG 0x3ff44014
+#define GPIO_OUT1_W1TC_REG 0x3ff44018
+#define GPIO_ENABLE_W1TS_REG 0x3ff44024
+#define GPIO_ENABLE_W1TC_REG 0x3ff44028
+#define GPIO_ENABLE1_W1TS_REG 0x3ff44030
+#define GPIO_ENABLE1_W1TC_REG 0x3ff44034
+#define GPIO_IN_REG 0x3ff4403c
+#define GPIO_IN1_REG 0x3ff44040
+
+#endif
@@ -0,0 +1,47 @@
+"""
+COBS framing of BSC data blocks (IBF1, link.h): frames with CRC-32 both ways,
+sync frames, binary data with zeros and DLE, a frame with wrong CRC.
+"""
+
+import sys
+
+from simtest import ACK, NAK, LF_LAST, LF_SYNC, Bsc, check, digits, frame
+
+
+def main():
+    b = Bsc()
+    b.cmd(b"F1")
+    ok = check("IBF1 returns ACK", b.res() == ACK)
+    n = 50000
+    msg = b"DATA? %d\n" % n
+    ok &= check("address device 3 to listen", b.listen(3))
+    b.send(b"IB\x10\x02" + frame(msg[:5], LF_SYNC))
+    ok &= check("frame with LfSync is answered with ACK", b.res() == ACK)
+    b.send(frame(msg[5:], LF_LAST))
+    ok &= check("write in frames returns ACK", b.res() == ACK)
+    ok &= check("address device 3 to talk", b.talk(3))
+    b.cmd(b"?")
+    d, k = b.frames()
+    ok &= check("read in %d frames, CRC right" % k, d == digits(n) and k > 1)
+    ok &= check("read returns ACK", b.res() == ACK)
+
+    blob = bytes(range(128))                     # Zeros, DLE, STX, ETX; the device keeps 128 bytes
+    d, r = b.query(4, blob, frm=True)
+    ok &= check("binary data is returned unchanged", d == blob and r == ACK)
+
+    bad = bytearray(frame(b"*CLS\n", LF_LAST))
+    bad[2] ^= 0x40                               # CRC does not match
+    b.listen(4)
+    b.send(b"IB\x10\x02" + bytes(bad) + frame(b"", LF_LAST))  # Its flags are not known, the block is ended
+    ok &= check("frame with wrong CRC returns NAK", b.res() == NAK)
+
+    b.cmd(b"F0")
+    ok &= check("IBF0 returns ACK", b.res() == ACK)
+    d, r = b.query(4, b"*IDN?\n")
+    ok &= check("DLE blocks again", d == b"WGPIB,SIM,4,0\n" and r == ACK)
+    b.close()
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,176 @@
+"""
+HiSLIP server (hislip.cpp) with a local client: initialization, queries in
+overlapped mode, long responses, a client which goes away during one, a device
+which does not answer, status query, locks, remote control, device clear, also
+of a read which hangs, trigger, SRQ and errors.
+"""
+
+import socket
+import struct
+import sys
+import time
+
+from simtest import HOST, HIS_PORT, NONE, check, digits, srq
+
+# Message types
+INIT, INIT_RESP, FATAL, ERROR, LOCK, LOCK_RESP, DATA, DATA_END = 0, 1, 2, 3, 4, 5, 6, 7
+CLR_DONE, CLR_ACK, REMOTE, REMOTE_RESP, TRIGGER = 8, 9, 10, 11, 12
+MAX_SIZE, MAX_SIZE_RESP, AINIT, AINIT_RESP, ACLEAR, SRQ, STATUS, STATUS_RESP = 15, 16, 17, 18, 19, 20, 21, 22
+ACLEAR_ACK, LOCK_INFO, LOCK_INFO_RESP = 23, 24, 25
+
+
+class Channel:
+    def __init__(self):
+        self.s = socket.create_connection((HOST, HIS_PORT))
+        self.s.settimeout(10)
+
+    def send(self, t, c=0, p=0, d=b""):
+        self.s.sendall(b"HS" + struct.pack(">BBIQ", t, c, p, len(d)) + d)
+
+    def recv(self, n):
+        b = b""
+        while len(b) < n:
+            x = self.s.recv(n - len(b))
+            if not x:
+                raise EOFError("connection closed")
+            b += x
+        return b
+
+    def get(self):
+        """Returns the next message: type, control code, parameter, payload."""
+        h = self.recv(16)
+        if h[:2] != b"HS":
+            raise ValueError("bad header")
+        t, c, p, n = struct.unpack(">BBIQ", h[2:])
+        return t, c, p, self.recv(n)
+
+    def resp(self):
+        """Returns the response to a query: data up to DataEnd, MessageID of DataEnd, number of messages."""
+        d = b""
+        k = 0
+        while True:
+            t, c, p, x = self.get()
+            d += x
+            k += 1
+            if t == DATA_END:
+                return d, p, k
+
+
+def session(sub):
+    """Opens session with sub-address sub; returns synchronous and asynchronous channel and InitResp."""
+    s = Channel()
+    s.send(INIT, 0, 0x01005858, sub)
+    r = s.get()
+    a = Channel()
+    a.send(AINIT, 0, r[2] & 0xFFFF)
+    a.get()
+    return s, a, r
+
+
+def main():
+    s, a, r = session(b"gpib0,5")
+    ok = check("InitResp, version 1.0, overlapped", r[0] == INIT_RESP and r[1] == 1 and r[2] >> 16 == 0x0100)
+    a.send(MAX_SIZE, 0, 0, struct.pack(">Q", 100))
+    ok &= check("MaxMessageSize", a.get()[0] == MAX_SIZE_RESP)
+
+    mid = 0xFFFFFF00
+    s.send(DATA_END, 0, mid, b"*IDN?\n")
+    d, p, k = s.resp()
+    ok &= check("query of gpib0,5", d == b"WGPIB,SIM,5,0\n" and p == mid)
+    s.send(DATA, 0, mid + 2, b"AB")             # Two queries sent without waiting
+    s.send(DATA_END, 0, mid + 2, b"C?\n")
+    s.send(DATA_END, 0, mid + 4, b"X" * 100 + b"?\n")
+    d, p, k = s.resp()
+    ok &= check("query in Data and DataEnd", d == b"ABC?\n" and p == mid + 2)
+    d, p, k = s.resp()
+    ok &= check("next query sent before the response", d == b"X" * 100 + b"?\n" and p == mid + 4)
+    s.send(DATA_END, 0, mid + 6, b"DATA? 20000\n")
+    d, p, k = s.resp()
+    ok &= check("long response in %d messages" % k, d == digits(20000) and k > 1 and p == mid + 6)
+    a.send(STATUS, 0, mid + 6)
+    ok &= check("AsyncStatusQuery", a.get()[0] == STATUS_RESP)
+
+    good = True
+    for i in range(5):
+        gs, ga, _ = session(b"gpib0,6")
+        gs.send(DATA_END, 0, 0, b"DATA? 2000000\n")
+        gs.get()
+        for c in (gs, ga):                      # Reset: the next send of the server fails
+            c.s.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+            c.s.close()
+        s3, a3, _ = session(b"gpib0,7")
+        s3.send(DATA_END, 0, 0, b"*IDN?\n")
+        d, p, k = s3.resp()
+        good &= d == b"WGPIB,SIM,7,0\n" and k == 1
+        s3.s.close()
+        a3.s.close()
+    ok &= check("query after a client went away during a read", good)
+
+    ns, na, _ = session(b"gpib0,%d" % NONE)
+    ns.send(DATA_END, 0, 0, b"*IDN?\n")
+    t = time.time()
+    d, p, k = ns.resp()
+    ok &= check("no device: empty DataEnd", d == b"" and k == 1 and time.time() - t < 2)
+    ns.s.close()
+    na.s.close()
+
+    a.send(LOCK, 1, 100)
+    ok &= check("exclusive lock", a.get()[:2] == (LOCK_RESP, 1))
+    a.send(LOCK_INFO)
+    ok &= check("AsyncLockInfo", a.get()[:3] == (LOCK_INFO_RESP, 1, 1))
+    s2, a2, _ = session(b"hislip5")
+    a2.send(LOCK, 1, 50)
+    ok &= check("lock of other session times out", a2.get()[:2] == (LOCK_RESP, 0))
+    a2.send(LOCK, 1, 5000)
+    a2.send(LOCK_INFO)
+    t = time.time()
+    ok &= check("channel is served while a lock request waits",
+                a2.get()[:3] == (LOCK_INFO_RESP, 1, 1) and time.time() - t < 0.5)
+    a.send(LOCK, 0)
+    ok &= check("release", a.get()[:2] == (LOCK_RESP, 1))
+    ok &= check("lock of other session then", a2.get()[:2] == (LOCK_RESP, 1))
+    a2.send(LOCK, 0)
+    a2.get()
+    s2.s.close()
+    a2.s.close()
+
+    a.send(REMOTE, 4)
+    ok &= check("AsyncRemoteLocalControl", a.get()[0] == REMOTE_RESP)
+    a.send(ACLEAR)
+    ok &= check("AsyncDeviceClear", a.get()[:2] == (ACLEAR_ACK, 1))
+    s.send(CLR_DONE, 1)
+    ok &= check("DeviceClearComplete", s.get()[:2] == (CLR_ACK, 1))
+    s.send(TRIGGER)
+    s.send(DATA_END, 0, mid + 8, b"T?\n")
+    d, p, k = s.resp()
+    ok &= check("query after Trigger", d == b"T?\n" and p == mid + 8)
+
+    hs, ha, _ = session(b"gpib0,8")
+    hs.send(DATA_END, 0, 1, b"HANG?\n")        # The device does not talk
+    time.sleep(0.1)
+    t = time.time()
+    ha.send(ACLEAR)
+    r = ha.get()
+    ok &= check("AsyncDeviceClear stops the read (%.0f ms)" % ((time.time() - t) * 1000),
+                r[0] == ACLEAR_ACK and time.time() - t < 0.5)
+    hs.send(CLR_DONE, 1)
+    ok &= check("response of the read is dropped", hs.get()[:2] == (CLR_ACK, 1))
+    hs.send(DATA_END, 0, 3, b"*IDN?\n")
+    ok &= check("query after device clear", hs.resp()[:2] == (b"WGPIB,SIM,8,0\n", 3))
+    hs.s.close()
+    ha.s.close()
+
+    srq(1)
+    ok &= check("SRQ on the asynchronous channel", a.get()[0] == SRQ)
+    srq(0)
+    s.send(99)
+    ok &= check("unknown message type: Error", s.get()[0] == ERROR)
+    s.s.close()
+    time.sleep(0.3)
+    a.s.settimeout(2)
+    ok &= check("asynchronous channel closed with the session", a.s.recv(16) == b"")
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
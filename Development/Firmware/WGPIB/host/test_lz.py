@@ -0,0 +1,42 @@
+"""
+Compression of BSC data blocks (IBL1, lz.h): reads in DLE blocks and in COBS
+frames are decoded by the host decoder (Development/Host/bsclz.py).
+"""
+
+import os
+import sys
+
+from simtest import ACK, Bsc, check, digits
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "..", "Host"))
+import bsclz  # noqa: E402
+
+
+def main():
+    n = 200000
+    b = Bsc()
+    b.cmd(b"L1")
+    ok = check("IBL1 returns ACK", b.res() == ACK)
+    d, r = b.query(5, b"DATA? %d\n" % n)
+    ok &= check("read in DLE block, %.0fx smaller" % (n / len(d)), bsclz.unpack(d) == digits(n) and r == ACK)
+    ok &= check("data is packed", len(d) < n // 10)
+    d, r = b.query(5, b"*IDN?\n")
+    ok &= check("short read", bsclz.unpack(d) == b"WGPIB,SIM,5,0\n" and r == ACK)
+
+    b.cmd(b"F1")
+    b.res()
+    d, r = b.query(5, b"DATA? %d\n" % n, frm=True)
+    ok &= check("read in COBS frames", bsclz.unpack(d) == digits(n) and r == ACK)
+    dec = bsclz.Decoder()
+    ok &= check("streaming decoder", dec.feed(d[:1000]) + dec.feed(d[1000:]) == digits(n))
+
+    b.cmd(b"L0")
+    ok &= check("IBL0 returns ACK", b.res() == ACK)
+    d, r = b.query(5, b"DATA? 1000\n", frm=True)
+    ok &= check("read is not packed after IBL0", d == digits(1000) and r == ACK)
+    b.close()
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,192 @@
+"""
+Bus scheduler (gpib.cpp): a long read gives the bus between its parts to a
+query of another device, not to one of the same device; a BSC read does the same.
+Bus time is shared by weights (IBq). Timeouts are kept per session; REN and power off (IBm, IBO) are only changed
+by a session which is alone.
+"""
+
+import socket
+import sys
+import threading
+import time
+
+from simtest import ACK, HOST, NAK, SCPI_PORT, UART_PORT, Bsc, check, digits
+
+N = 2000000                 # Bytes of the long read, about 2 s on the simulated bus
+
+
+def bulk(port, n, res):
+    """Reads DATA? n on raw socket port; stores the data and time of its end in res."""
+    s = socket.create_connection((HOST, port))
+    s.sendall(b"DATA? %d\n" % n)
+    d = bytearray()
+    while len(d) < n + 1:
+        b = s.recv(65536)
+        if not b:
+            break
+        d += b
+    res["end"] = time.time()
+    res["data"] = bytes(d)
+    s.close()
+
+
+def idn(port, k=1):
+    """Sends *IDN? k times on raw socket port; returns the last response and the longest wait."""
+    s = socket.create_connection((HOST, port))
+    w = 0
+    for _ in range(k):
+        t = time.time()
+        s.sendall(b"*IDN?\n")
+        r = s.recv(100)
+        w = max(w, time.time() - t)
+    s.close()
+    return r, w
+
+
+def check_other():
+    """Queries of device 2 during a long read of device 1 wait for one part at most."""
+    res = {}
+    th = threading.Thread(target=bulk, args=(SCPI_PORT, N, res))
+    th.start()
+    time.sleep(0.3)
+    r, w = idn(SCPI_PORT + 1, 20)
+    th.join()
+    ok = check("query of other device during long read", r == b"WGPIB,SIM,2,0\n")
+    ok &= check("it waits for one part at most (%.1f ms)" % (w * 1000), w < 0.1)
+    ok &= check("long read is complete", res["data"] == digits(N))
+    return ok
+
+
+def check_same():
+    """A query of the device of a long read waits for its end, both responses are complete."""
+    res = {}
+    th = threading.Thread(target=bulk, args=(SCPI_PORT, N, res))
+    th.start()
+    time.sleep(0.3)
+    r, w = idn(SCPI_PORT)
+    t = time.time()
+    th.join()
+    ok = check("query of the same device during long read", r == b"WGPIB,SIM,1,0\n")
+    ok &= check("it waits for the end of the read", t >= res["end"] - 0.05)
+    ok &= check("long read is not interrupted", res["data"] == digits(N))
+    return ok
+
+
+def check_bsc():
+    """A BSC read (IB?) of device 2 gives the bus to queries of device 1."""
+    n = 300000
+    b = Bsc()
+    ok = b.listen(2) and b.write(b"DATA? %d\n" % n) == ACK and b.talk(2)
+    res = {}
+
+    def q():
+        time.sleep(0.05)
+        res["idn"] = idn(SCPI_PORT, 20)
+    th = threading.Thread(target=q)
+    th.start()
+    b.cmd(b"?")
+    d = b.block()
+    ok &= check("BSC read of device 2", d == digits(n) and b.res() == ACK)
+    th.join()
+    r, w = res["idn"]
+    ok &= check("query of device 1 meanwhile (%.1f ms)" % (w * 1000), r == b"WGPIB,SIM,1,0\n" and w < 0.1)
+    b.close()
+    return ok
+
+
+def check_tmo():
+    """IBf of a BSC session sets the timeout of its reads only, not of another session."""
+    b = Bsc()
+    u = Bsc(UART_PORT)
+    b.cmd(b"f3")                                # About 100 ms
+    ok = check("IBf3 returns ACK", b.res() == ACK)
+    res = {}
+    for c, a, k in ((b, 9, "b"), (u, 10, "u")):
+        t = time.time()
+        d, r = c.query(a, b"HANG?\n")
+        res[k] = (r, time.time() - t)
+    r, t = res["b"]
+    ok &= check("read of the session times out after IBf (%.0f ms)" % (t * 1000), r == 9 and t < 0.5)
+    r, t = res["u"]
+    ok &= check("read of other session after the default (%.0f ms)" % (t * 1000), r == 9 and t > 0.8)
+    b.close()
+    u.close()
+    return ok
+
+
+def check_alone():
+    """IBm is refused while another session which has used the bus is open."""
+    b = Bsc()
+    b.cmd(b"m1")
+    ok = check("IBm1 of the only session returns ACK", b.res() == ACK)
+    u = Bsc(UART_PORT)                          # Stays open, a line has no end
+    ok &= check("other session on the UART", u.query(3, b"*IDN?\n") == (b"WGPIB,SIM,3,0\n", ACK))
+    b.cmd(b"m0")
+    ok &= check("IBm0 returns NAK then", b.res() == NAK)
+    u.cmd(b"f3")
+    u.res()
+    b.cmd(b"O")                                 # State of b only; it returns nothing
+    b.cmd(b"f3")
+    ok &= check("IBO does not end the other session", b.res() == ACK and u.query(3, b"*IDN?\n") == (b"WGPIB,SIM,3,0\n", ACK))
+    t = time.time()
+    d, r = u.query(9, b"HANG?\n")
+    ok &= check("nor reset its timeouts", r == 9 and time.time() - t < 0.5)
+    u.cmd(b"f31")
+    u.res()
+    b.close()
+    u.close()
+    return ok
+
+
+def check_weight():
+    """Long reads of two BSC sessions with weights 1 and 3 get 1/4 and 3/4 of the bus."""
+    b = Bsc()
+    u = Bsc(UART_PORT)
+    u.cmd(b"q3")
+    ok = check("IBq3 returns ACK", u.res() == ACK)
+    u.cmd(b"q?")
+    ok &= check("IBq? returns the weight", u.res() == 3)
+    got = {}
+
+    def rd(c, a, n, k):
+        """Reads DATA? n of device a with IB?, noting the time of each part; setup and read are one transaction."""
+        ok = c.listen(a) and c.write(b"DATA? %d\n" % n) == ACK and c.talk(a)
+        c.cmd(b"?")
+        t, d = [], b""
+        while b"\x10\x03" not in d[-70000:]:  # The digits have no DLE
+            d += c.s.recv(65536)
+            t.append((time.time(), len(d)))
+        c.buf = d[d.index(b"\x10\x03") + 2:]
+        got[k] = t
+        got[k + "res"] = c.res() if ok else None
+    th = [threading.Thread(target=rd, args=(b, 11, 1000000, "b")), threading.Thread(target=rd, args=(u, 12, 2000000, "u"))]
+    for x in th:
+        x.start()
+    for x in th:
+        x.join()
+
+    def part(t, t0, t1):
+        return max([m for x, m in t if x <= t1] + [0]) - max([m for x, m in t if x <= t0] + [0])
+    ok &= check("both reads return ACK", got["bres"] == ACK and got["ures"] == ACK)
+    t0 = min(got["b"][0][0], got["u"][0][0]) + 0.3
+    r = part(got["u"], t0, t0 + 1) / max(part(got["b"], t0, t0 + 1), 1)
+    ok &= check("weights 1:3 give bus time 1:%.1f" % r, 2.3 < r < 3.9)
+    u.cmd(b"q1")
+    u.res()
+    b.close()
+    u.close()
+    return ok
+
+
+def main():
+    ok = check_alone()
+    ok &= check_other()
+    ok &= check_same()
+    ok &= check_bsc()
+    ok &= check_tmo()
+    ok &= check_weight()
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
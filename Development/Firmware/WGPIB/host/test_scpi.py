@@ -0,0 +1,80 @@
+"""
+Raw socket server (scpi.cpp): one GPIB address per port, queries, messages
+split over segments or sent together, LF within a definite length block, long
+responses and a client which does not end its message.
+"""
+
+import socket
+import sys
+import time
+
+from simtest import HOST, SCPI_PORT, check, digits
+
+
+class Client:
+    def __init__(self, port):
+        self.s = socket.create_connection((HOST, port))
+        self.s.settimeout(10)
+        self.buf = b""
+
+    def line(self):
+        """Returns the next response, up to LF."""
+        while b"\n" not in self.buf:
+            d = self.s.recv(65536)
+            if not d:
+                raise EOFError("connection closed")
+            self.buf += d
+        i = self.buf.index(b"\n") + 1
+        r, self.buf = self.buf[:i], self.buf[i:]
+        return r
+
+    def read(self, n):
+        """Returns the next n bytes of responses."""
+        while len(self.buf) < n:
+            d = self.s.recv(65536)
+            if not d:
+                raise EOFError("connection closed")
+            self.buf += d
+        r, self.buf = self.buf[:n], self.buf[n:]
+        return r
+
+    def query(self, m):
+        self.s.sendall(m)
+        return self.line()
+
+
+def main():
+    ok = True
+    for i in range(4):
+        c = Client(SCPI_PORT + i)
+        ok &= check("port %d is GPIB address %d" % (SCPI_PORT + i, i + 1), c.query(b"*IDN?\n") == b"WGPIB,SIM,%d,0\n" % (i + 1))
+        c.s.close()
+
+    c = Client(SCPI_PORT)
+    c.s.sendall(b"*ID")
+    time.sleep(0.2)
+    ok &= check("message in two segments", c.query(b"N?\n") == b"WGPIB,SIM,1,0\n")
+    c.s.sendall(b"*IDN?\nAB?\n")
+    ok &= check("two messages in one segment", c.line() == b"WGPIB,SIM,1,0\n" and c.line() == b"AB?\n")
+    m = b"#14a\nb?X?\n"                        # The device returns the whole message
+    c.s.sendall(m)
+    ok &= check("LF within a block does not end the message", c.read(len(m)) == m)
+    c.s.sendall(b"*CLS\n")
+    ok &= check("message without '?' has no response", c.query(b"*IDN?\n") == b"WGPIB,SIM,1,0\n")
+    n = 1000000
+    ok &= check("long response", c.query(b"DATA? %d\n" % n) == digits(n))
+
+    c.s.sendall(b"*IDN")                         # Not ended: sent after ScpiTmo without EOI
+    t = time.time()
+    o = Client(SCPI_PORT + 1)
+    r = o.query(b"*IDN?\n")
+    ok &= check("stalled client holds the bus up to ScpiTmo (%.0f ms)" % ((time.time() - t) * 1000),
+                r == b"WGPIB,SIM,2,0\n" and time.time() - t < 2.5)
+    o.s.close()
+    ok &= check("session goes on after it", c.query(b"*IDN?\n") == b"WGPIB,SIM,1,0\n")
+    c.s.close()
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,54 @@
+"""
+BSC protocol on the UART (link.cpp; the sim takes a TCP connection for the line):
+rate command IBu, confirmed at the new rate or set back after BaudTmo; other
+sessions use the bus while it waits.
+"""
+
+import socket
+import struct
+import sys
+import time
+
+from simtest import ACK, HOST, NAK, SCPI_PORT, UART_PORT, Bsc, check
+
+BAUD_TMO = 2.0              # BaudTmo of bsc.cpp, s
+
+
+def rate(b):
+    b.cmd(b"u?")
+    return struct.unpack("<I", b.read(4))[0]
+
+
+def main():
+    u = Bsc(UART_PORT)
+    time.sleep(0.2)
+    ok = check("IBu? returns the rate after reset", rate(u) == 115200)
+    u.cmd(b"u3000000")
+    ok &= check("IBu3000000 returns ACK", u.res() == ACK)
+    ok &= check("rate is kept when the host goes on", rate(u) == 3000000)
+    u.cmd(b"u921600")
+    ok &= check("IBu921600 returns ACK", u.res() == ACK)
+    t = time.time()
+    with socket.create_connection((HOST, SCPI_PORT)) as c:
+        c.settimeout(10)
+        c.sendall(b"*IDN?\n")
+        r = c.recv(100)
+    ok &= check("query of another session meanwhile (%.0f ms)" % ((time.time() - t) * 1000),
+                r == b"WGPIB,SIM,1,0\n" and time.time() - t < 0.5)
+    time.sleep(BAUD_TMO + 0.5)
+    ok &= check("rate is set back without the host", rate(u) == 3000000)
+    u.cmd(b"u100")
+    ok &= check("rate out of range returns NAK", u.res() == NAK)
+    u.cmd(b"u115200")
+    u.res()
+    u.close()
+
+    t = Bsc()
+    t.cmd(b"u?")
+    ok &= check("IBu on TCP returns NAK", t.res() == NAK)
+    t.close()
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
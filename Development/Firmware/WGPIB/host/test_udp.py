@@ -0,0 +1,63 @@
+"""
+UDP streaming (udp.cpp) end to end with the receiver of Development/Host/udprx.py:
+a long read with datagrams lost on purpose, periodic polls, a request of a
+datagram which is gone, other senders and unregistering.
+"""
+
+import os
+import random
+import socket
+import sys
+import time
+
+from simtest import HOST, UDP_PORT, check, digits
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "..", "Host"))
+import udprx  # noqa: E402
+
+
+def main():
+    random.seed(1)
+    r = udprx.Receiver(HOST, UDP_PORT, loss=0.1)
+    ok = check("register, heartbeat with sequence 0", r.register())
+    n = 100000
+    r.poll(3, 0, b"DATA? %d" % n)
+    x = list(r.reads(1, 10))
+    ok &= check("read of %d bytes, %d datagrams requested again" % (n, r.naks),
+                len(x) == 1 and x[0][1:] == (3, 6, digits(n)) and r.naks > 0)
+
+    r.loss = 0
+    r.poll(1, 50, b"*IDN?")
+    t = time.time()
+    x = list(r.reads(10, 3))
+    t = time.time() - t
+    r.stop()
+    ok &= check("periodic poll, 10 reads in %.0f ms" % (t * 1000),
+                len(x) == 10 and all(y[3] == b"WGPIB,SIM,1,0\n" for y in x) and 0.3 < t < 1.5)
+    ok &= check("reads are numbered in order", [y[0] for y in x] == list(range(x[0][0], x[0][0] + 10)))
+
+    r.send(b"N0")
+    h = r.get()
+    while h[3] & udprx.UF_BEAT:
+        h = r.get()
+    ok &= check("request of a datagram out of the window: UfGone", h[0] == 0 and h[3] & udprx.UF_GONE)
+
+    o = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    o.sendto(b"P2,0,*IDN?\n", (HOST, UDP_PORT))
+    ok &= check("poll of other sender is ignored", list(r.reads(1, 1.5)) == [])
+    o.close()
+
+    r.unregister()
+    time.sleep(0.1)
+    r.s.settimeout(1.5)
+    try:
+        r.get()
+        quiet = False
+    except socket.timeout:
+        quiet = True
+    ok &= check("no heartbeat after unregistering", quiet)
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
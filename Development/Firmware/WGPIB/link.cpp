@@ -0,0 +1,303 @@
+/*
+Host link of WGPIB firmware, see link.h.
+*/
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#include "driver/uart.h"
+#include "rom/crc.h"
+#include "link.h"
+
+#define UartNum UART_NUM_0		// To FT230X
+
+// Counters per kind of link, [0] UART, [1] TCP
+#define LnkKind(l) ((l)->fd!=LnkUart)
+static uint32_t LnkRxCnt[2], LnkTxCnt[2];	// Bytes received and sent
+static uint32_t LnkBadCnt[2];				// Frames with CRC error or cut (LnkBad)
+
+void LnkInit(Link *l, int fd){
+	l->fd=fd;
+	l->ip=0; l->in=0;
+	l->on=0;
+	l->end=0;
+	l->cn=0;
+	l->fn=0;
+	l->crc=0;
+}
+
+
+//Routine fills input buffer; it waits up to ms. Returns number of bytes, 0 on timeout.
+static int LnkFill(Link *l, uint32_t ms){
+	size_t k;
+	int n, t;
+	fd_set fs;
+	struct timeval tv;
+	if(l->end) return 0;
+	if(l->fd==LnkUart){
+		n=uart_read_bytes(UartNum,l->ib,1,pdMS_TO_TICKS(ms));
+		if(n<=0) return 0;
+		uart_get_buffered_data_len(UartNum,&k);
+		if(k>LnkIn-1) k=LnkIn-1;
+		if(k && (t=uart_read_bytes(UartNum,l->ib+1,k,0))>0) n+=t;	// The rest without waiting
+	}
+	else{
+		FD_ZERO(&fs);
+		FD_SET(l->fd,&fs);
+		tv.tv_sec=ms/1000;
+		tv.tv_usec=ms%1000*1000;
+		if(select(l->fd+1,&fs,0,0,&tv)<=0) return 0;
+		n=recv(l->fd,l->ib,LnkIn,0);
+		if(n<=0) {l->end=1; return 0;}
+	}
+	l->ip=0;
+	l->in=n;
+	LnkRxCnt[LnkKind(l)]+=n;
+	return n;
+}
+
+
+/*
+Routine returns the next byte from the host. It waits up to ms.
+Returns LnkTmo if no byte came, LnkEnd if the link is closed.
+*/
+int LnkGet(Link *l, uint32_t ms){
+	if(l->ip==l->in){
+		if(l->end) return LnkEnd;
+		if(!LnkFill(l,0)){
+			LnkFlush(l);
+			if(!LnkFill(l,ms)) return l->end ? LnkEnd : LnkTmo;
+		}
+	}
+	return l->ib[l->ip++];
+}
+
+
+//Returns number of bytes which can be read without waiting.
+int LnkAvail(Link *l){
+	if(l->ip==l->in) LnkFill(l,0);
+	return l->in-l->ip;
+}
+
+
+void LnkPut(Link *l, uint8_t c){
+	if(l->on==LnkOut) LnkFlush(l);
+	l->ob[l->on++]=c;
+}
+
+
+void LnkWrite(Link *l, const uint8_t *p, uint32_t n){
+	uint32_t k;
+	while(n){
+		if(l->on==LnkOut) LnkFlush(l);
+		k=LnkOut-l->on;
+		if(k>n) k=n;
+		memcpy(l->ob+l->on,p,k);
+		l->on+=k;
+		p+=k; n-=k;
+	}
+}
+
+
+//Routine sends the output buffer. Returns -1 if the link is closed.
+int LnkFlush(Link *l){
+	int k, n=0;
+	if(l->end) {l->on=0; return -1;}
+	if(l->fd==LnkUart) n=uart_write_bytes(UartNum,(const char *)l->ob,l->on);	// Copied to the driver buffer
+	else while(n<l->on){
+		k=send(l->fd,l->ob+n,l->on-n,0);
+		if(k<=0) {l->end=1; break;}
+		n+=k;
+	}
+	if(n>0) LnkTxCnt[LnkKind(l)]+=n;
+	l->on=0;
+	return l->end ? -1 : 0;
+}
+
+
+/*
+Routine starts the UART at baud. It is called from a task on core 0, as the driver
+interrupt is allocated on the calling core and core 1 is left to the GPIB engine.
+FIFO thresholds keep interrupts at about one per 100 bytes at 3 Mbaud.
+*/
+void LnkUartBegin(uint32_t baud){
+	uart_config_t c;
+	memset(&c,0,sizeof(c));
+	c.baud_rate=baud;
+	c.data_bits=UART_DATA_8_BITS;
+	c.parity=UART_PARITY_DISABLE;
+	c.stop_bits=UART_STOP_BITS_1;
+	c.flow_ctrl=LnkRts>=0 && LnkCts>=0 ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE;
+	c.rx_flow_ctrl_thresh=100;
+	c.source_clk=UART_SCLK_APB;
+	uart_param_config(UartNum,&c);
+	uart_set_pin(UartNum,UART_PIN_NO_CHANGE,UART_PIN_NO_CHANGE,LnkRts,LnkCts);
+	uart_driver_install(UartNum,LnkUartRx,LnkUartTx,0,0,0);
+	uart_set_rx_full_threshold(UartNum,100);
+	uart_set_tx_empty_threshold(UartNum,32);
+	uart_set_rx_timeout(UartNum,10);		// Symbols; the rest of a burst is not left in the FIFO
+}
+
+/*
+Routine changes the UART rate after the output is sent. Divider of the APB clock
+has 1/16 steps, so the error is below 0.3% up to LnkBaudMax. Returns 0 if the rate
+is out of range.
+*/
+uint8_t LnkBaud(uint32_t baud){
+	if(baud<LnkBaudMin || baud>LnkBaudMax) return 0;
+	uart_wait_tx_done(UartNum,pdMS_TO_TICKS(100));
+	uart_set_baudrate(UartNum,baud);
+	uart_flush_input(UartNum);
+	return 1;
+}
+
+uint32_t LnkBaudGet(void){
+	uint32_t b=0;
+	uart_get_baudrate(UartNum,&b);
+	return b;
+}
+
+
+//Routine sends COBS block in cb; its code is the length+1, 0xff if no zero follows.
+static void CobsBlk(Link *l){
+	LnkPut(l,l->cn+1);
+	LnkWrite(l,l->cb,l->cn);
+	l->cn=0;
+}
+
+//Routine COBS encodes n bytes at p; runs without zero are copied whole.
+static void CobsPut(Link *l, const uint8_t *p, uint32_t n){
+	const uint8_t *z;
+	uint32_t k;
+	while(n){
+		k=sizeof(l->cb)-l->cn;
+		if(k>n) k=n;
+		z=(const uint8_t *)memchr(p,0,k);
+		if(z) k=z-p;
+		memcpy(l->cb+l->cn,p,k);
+		l->cn+=k;
+		p+=k; n-=k;
+		if(z) {CobsBlk(l); p++; n--;}		// Zero ends the block
+		else if(l->cn==sizeof(l->cb)) CobsBlk(l);
+	}
+}
+
+
+//Routine sends n data bytes in frames; a frame is ended when it has LnkFrm bytes.
+void LnkFrmWrite(Link *l, const uint8_t *p, uint32_t n){
+	uint32_t k;
+	while(n){
+		k=LnkFrm-l->fn;
+		if(k>n) k=n;
+		l->crc=crc32_le(l->crc,p,k);
+		CobsPut(l,p,k);
+		l->fn+=k;
+		p+=k; n-=k;
+		if(l->fn==LnkFrm) LnkFrmEnd(l,0);
+	}
+}
+
+//Routine ends the frame being sent with flags flg; the frame may have no data.
+void LnkFrmEnd(Link *l, uint8_t flg){
+	uint8_t t[5];
+	t[0]=flg;
+	l->crc=crc32_le(l->crc,t,1);
+	t[1]=l->crc; t[2]=l->crc>>8; t[3]=l->crc>>16; t[4]=l->crc>>24;
+	CobsPut(l,t,5);
+	CobsBlk(l);
+	LnkPut(l,0);
+	l->fn=0;
+	l->crc=0;
+}
+
+
+/*
+Routine receives one frame from the host to p (LnkFrm+5 bytes) and sets flg to
+its flags; it waits as long as needed. Blocks are copied from the input buffer
+whole. Returns number of data bytes, LnkBad if the frame is wrong, LnkEnd if the
+link is closed.
+*/
+int LnkFrmRead(Link *l, uint8_t *p, uint8_t *flg){
+	const uint8_t *a, *z;
+	uint32_t n=0, k=0, m, crc;
+	uint8_t code=0xff, st=0, bad=0;
+	int c;
+	for(;;){
+		if(l->ip==l->in){
+			c=LnkGet(l,10);
+			if(c==LnkTmo) continue;
+			if(c==LnkEnd) return LnkEnd;
+			l->ip--;
+		}
+		a=l->ib+l->ip;
+		m=l->in-l->ip;
+		if(!k){								// Code byte
+			l->ip++;
+			if(!*a){						// Delimiter
+				if(st) break;
+				continue;					// Empty frame
+			}
+			st=1;
+			if(code<0xff && n<LnkFrm+5) p[n++]=0;
+			else if(code<0xff) bad=1;
+			code=*a;
+			k=code-1;
+			continue;
+		}
+		if(m>k) m=k;
+		z=(const uint8_t *)memchr(a,0,m);
+		if(z){								// Delimiter within a block: frame is cut
+			l->ip+=z-a+1;
+			bad=1;
+			break;
+		}
+		if(n+m>LnkFrm+5) bad=1;
+		else {memcpy(p+n,a,m); n+=m;}
+		l->ip+=m;
+		k-=m;
+	}
+	if(bad || n<5) {LnkBadCnt[LnkKind(l)]++; return LnkBad;}
+	crc=crc32_le(0,p,n-4);
+	if(p[n-4]!=(uint8_t)crc || p[n-3]!=(uint8_t)(crc>>8) || p[n-2]!=(uint8_t)(crc>>16) || p[n-1]!=(uint8_t)(crc>>24)){
+		LnkBadCnt[LnkKind(l)]++;
+		return LnkBad;
+	}
+	*flg=p[n-5];
+	return n-5;
+}
+
+
+//Routine opens TCP server socket on port. Returns the socket or -1.
+int TcpListen(uint16_t port){
+	int fd, on=1;
+	struct sockaddr_in a;
+	fd=socket(AF_INET,SOCK_STREAM,0);
+	if(fd<0) return -1;
+	setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	memset(&a,0,sizeof(a));
+	a.sin_family=AF_INET;
+	a.sin_port=htons(port);
+	a.sin_addr.s_addr=htonl(INADDR_ANY);
+	if(bind(fd,(struct sockaddr *)&a,sizeof(a))<0 || listen(fd,2)<0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+//Routine writes counters of the host links in Prometheus exposition format to p. Returns the length.
+int LnkMetrics(char *p, int max){
+	static const char *Name[2]={"uart","tcp"};
+	int n=0, i;
+	if(max<=0) return 0;
+	n=snprintf(p,max,"# TYPE gpib_link_received_bytes_total counter\n");
+	for(i=0;i<2 && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_link_received_bytes_total{link=\"%s\"} %u\n",Name[i],(unsigned)LnkRxCnt[i]);
+	if(n<max) n+=snprintf(p+n,max-n,"# TYPE gpib_link_sent_bytes_total counter\n");
+	for(i=0;i<2 && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_link_sent_bytes_total{link=\"%s\"} %u\n",Name[i],(unsigned)LnkTxCnt[i]);
+	if(n<max) n+=snprintf(p+n,max-n,"# TYPE gpib_link_frame_errors_total counter\n");
+	for(i=0;i<2 && n<max;i++)
+		n+=snprintf(p+n,max-n,"gpib_link_frame_errors_total{link=\"%s\"} %u\n",Name[i],(unsigned)LnkBadCnt[i]);
+	return n<max ? n : max-1;
+}
@@ -0,0 +1,71 @@
+/*
+Host link of WGPIB firmware: UART to FT230X (USB) or TCP connection.
+Input and output are buffered; output is sent by LnkFlush, which is called
+before the link waits for input.
+
+UART: ESP-IDF driver with interrupt-fed ring buffers of LnkUartRx and LnkUartTx
+bytes behind the FIFOs, so the link buffers are filled and drained in blocks while
+the driver moves the bytes. Rate is set by the host with IBu up to LnkBaudMax
+(FT230X limit). RTS#/CTS# of the FT230X are not connected on Rev.0: without
+LnkRts/LnkCts the host sends at most LnkUartRx bytes of write data before a sync
+(<DLE><ACK> or LfSync) and waits for its ACK.
+
+Frames (COBS): data of up to LnkFrm bytes, flags byte LfXxx and CRC-32 (IEEE, LSB
+first) of both, encoded with Consistent Overhead Byte Stuffing and ended by a zero
+byte. The encoded frame contains no zero, so the receiver finds its end with memchr;
+overhead is 1 byte per 254 and the delimiter. Empty frames (zero alone) are ignored.
+*/
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+
+#define LnkUart (-1)		// Link.fd of the UART link
+#define LnkTmo (-1)			// LnkGet: no byte within the time
+#define LnkEnd (-2)			// LnkGet: link closed
+
+#define LnkIn 512			// Input buffer size
+#define LnkOut 1460			// Output buffer size, one TCP segment
+#define LnkFrm 1024			// Data bytes of a frame, at most
+#define LnkUartRx 16384		// UART driver buffers
+#define LnkUartTx 8192
+#define LnkRts (-1)			// GPIO of RTS and CTS for hardware flow control; -1: not connected
+#define LnkCts (-1)
+#define LnkBaudMin 9600
+#define LnkBaudMax 3000000
+#define LnkBad (-3)			// LnkFrmRead: CRC error or too long frame
+
+// Flags of a frame
+#define LfLast 0x01			// Last frame of the block
+#define LfSync 0x02			// Host to adapter: reply ACK when the data before is on the bus
+
+typedef struct{
+	int fd;					// TCP socket or LnkUart
+	uint16_t ip, in;		// Next byte and number of bytes in ib
+	uint16_t on;			// Number of bytes in ob
+	uint8_t end;			// Connection closed or failed
+	uint8_t cn;				// Bytes in cb
+	uint16_t fn;			// Data bytes of the frame being sent
+	uint32_t crc;			// Its CRC so far
+	uint8_t cb[254];		// COBS block being encoded
+	uint8_t ib[LnkIn];
+	uint8_t ob[LnkOut];
+} Link;
+
+void LnkInit(Link *l, int fd);
+int LnkGet(Link *l, uint32_t ms);
+int LnkAvail(Link *l);
+void LnkPut(Link *l, uint8_t c);
+void LnkWrite(Link *l, const uint8_t *p, uint32_t n);
+int LnkFlush(Link *l);
+void LnkUartBegin(uint32_t baud);
+uint8_t LnkBaud(uint32_t baud);
+uint32_t LnkBaudGet(void);
+void LnkFrmWrite(Link *l, const uint8_t *p, uint32_t n);
+void LnkFrmEnd(Link *l, uint8_t flg);
+int LnkFrmRead(Link *l, uint8_t *p, uint8_t *flg);
+int TcpListen(uint16_t port);
+int LnkMetrics(char *p, int max);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+Block LZ compression of WGPIB firmware, see lz.h.
+Greedy parse: the position of each 4 byte sequence is kept in a hash table, a
+match found there is extended as far as it goes. Positions within a match are
+not added, which keeps it fast enough for data at Wi-Fi rates.
+*/
+
+#include <string.h>
+#include "lz.h"
+
+static inline uint32_t Rd32(const uint8_t *p){
+	uint32_t v;
+	memcpy(&v,p,4);
+	return v;
+}
+
+//Routine writes length extension v (bytes of 255, then the rest).
+static inline void LzExt(uint8_t *o, uint32_t *op, uint32_t v){
+	for(;v>=255;v-=255) o[(*op)++]=255;
+	o[(*op)++]=v;
+}
+
+/*
+Routine writes sequence of nl literals at l and match of length ml (0: none) at
+distance d. Returns 0 if it does not fit in max.
+*/
+static uint8_t LzSeq(uint8_t *o, uint32_t *op, uint32_t max, const uint8_t *l, uint32_t nl, uint32_t d, uint32_t ml){
+	uint32_t t;
+	if(*op+1+nl/255+1+nl+2+ml/255+1>max) return 0;
+	t=(nl<15 ? nl : 15)<<4;
+	if(ml) t|=ml-4<15 ? ml-4 : 15;
+	o[(*op)++]=t;
+	if(nl>=15) LzExt(o,op,nl-15);
+	memcpy(o+*op,l,nl);
+	*op+=nl;
+	if(!ml) return 1;
+	o[(*op)++]=d;
+	o[(*op)++]=d>>8;
+	if(ml-4>=15) LzExt(o,op,ml-19);
+	return 1;
+}
+
+
+/*
+Routine compresses n bytes (up to LzBlk) at p to o; h is the hash table of
+1<<LzBits entries. Returns the compressed length, 0 if it is not below max.
+*/
+uint32_t LzPack(uint16_t *h, const uint8_t *p, uint32_t n, uint8_t *o, uint32_t max){
+	uint32_t i=0, a=0, r, m, v, op=0;
+	memset(h,0,sizeof(uint16_t)<<LzBits);	// Positions are kept +1, 0 is none
+	while(i+4<=n){
+		v=Rd32(p+i);
+		r=h[(v*2654435761u)>>(32-LzBits)];
+		h[(v*2654435761u)>>(32-LzBits)]=i+1;
+		if(!r || Rd32(p+r-1)!=v) {i++; continue;}
+		r--;
+		for(m=4;i+m<n && p[r+m]==p[i+m];m++);
+		if(!LzSeq(o,&op,max,p+a,i-a,i-r,m)) return 0;
+		i+=m;
+		a=i;
+	}
+	if(a<n && !LzSeq(o,&op,max,p+a,n-a,0,0)) return 0;
+	return op<max ? op : 0;
+}
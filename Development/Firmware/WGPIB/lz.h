@@ -0,0 +1,26 @@
+/*
+Block LZ compression of WGPIB firmware, for read data sent to the host.
+A block of up to LzBlk bytes is compressed alone, so the decoder needs no state
+between blocks and memory is fixed: the hash table and the blocks.
+
+Compressed block: sequences of
+	token		high 4 bits literal count, low 4 bits match length-4;
+				15 is followed by bytes added to it, up to a byte below 255
+	literals
+	offset		2 bytes LSB first, distance back in the decoded block (1 ...)
+	(length)	bytes added to match length 15 as above
+The last sequence has literals only and ends with the block; it is left out
+if there are no literals. Matches may overlap the bytes they produce.
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+#define LzBlk 4096			// Largest block
+#define LzBits 12			// Hash table of 1<<LzBits positions
+
+uint32_t LzPack(uint16_t *h, const uint8_t *p, uint32_t n, uint8_t *o, uint32_t max);
+
+#endif
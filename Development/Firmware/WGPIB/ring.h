@@ -0,0 +1,112 @@
+/*
+Lock-free single-producer/single-consumer ring of bytes.
+
+head is written only by the producer, tail only by the consumer. Each side reads
+the index of the other one with acquire and publishes its own with release order,
+so bytes written before publishing are visible on the other core when the index is.
+Indices run free and wrap at 2^32; size of the ring is a power of 2.
+Records (GpOp, GpEv) are stored with RingWrite and published at once.
+*/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define RingFn static inline __attribute__((always_inline))
+
+#define RingLd(x) __atomic_load_n(&(x),__ATOMIC_ACQUIRE)
+#define RingSt(x,v) __atomic_store_n(&(x),(v),__ATOMIC_RELEASE)
+
+typedef struct{
+	uint32_t head;			// Next byte to write; producer
+	uint32_t tail;			// Next byte to read; consumer
+	uint32_t msk;			// Size-1
+	uint8_t *buf;
+} Ring;
+
+RingFn void RingInit(Ring *r, uint8_t *buf, uint32_t size){
+	r->head=0;
+	r->tail=0;
+	r->msk=size-1;
+	r->buf=buf;
+}
+
+
+// Consumer side
+
+//Returns number of bytes which can be read.
+RingFn uint32_t RingUsed(Ring *r){
+	return RingLd(r->head)-r->tail;
+}
+
+//Returns byte i after tail without removing it; i<RingUsed.
+RingFn uint8_t RingPeek(Ring *r, uint32_t i){
+	return r->buf[(r->tail+i)&r->msk];
+}
+
+//Removes and returns one byte; RingUsed must be non-zero.
+RingFn uint8_t RingGet(Ring *r){
+	uint8_t c=r->buf[r->tail&r->msk];
+	RingSt(r->tail,r->tail+1);
+	return c;
+}
+
+//Sets p to the first readable byte and returns number of bytes readable there without wrap.
+RingFn uint32_t RingRdSpan(Ring *r, uint8_t **p){
+	uint32_t n=RingUsed(r), t=r->tail&r->msk;
+	*p=r->buf+t;
+	return n<r->msk+1-t ? n : r->msk+1-t;
+}
+
+//Removes n bytes; n<=RingUsed.
+RingFn void RingSkip(Ring *r, uint32_t n){
+	RingSt(r->tail,r->tail+n);
+}
+
+//Copies n bytes to p and removes them; n<=RingUsed.
+RingFn void RingRead(Ring *r, void *p, uint32_t n){
+	uint32_t t=r->tail&r->msk, k=r->msk+1-t;
+	if(k>n) k=n;
+	memcpy(p,r->buf+t,k);
+	memcpy((uint8_t *)p+k,r->buf,n-k);
+	RingSt(r->tail,r->tail+n);
+}
+
+
+// Producer side
+
+//Returns number of bytes which can be written.
+RingFn uint32_t RingFree(Ring *r){
+	return r->msk+1-(r->head-RingLd(r->tail));
+}
+
+//Writes one byte; RingFree must be non-zero.
+RingFn void RingPut(Ring *r, uint8_t c){
+	r->buf[r->head&r->msk]=c;
+	RingSt(r->head,r->head+1);
+}
+
+//Sets p to the first free byte and returns number of bytes writable there without wrap.
+RingFn uint32_t RingWrSpan(Ring *r, uint8_t **p){
+	uint32_t n=RingFree(r), h=r->head&r->msk;
+	*p=r->buf+h;
+	return n<r->msk+1-h ? n : r->msk+1-h;
+}
+
+//Publishes n bytes written at RingWrSpan.
+RingFn void RingWrDone(Ring *r, uint32_t n){
+	RingSt(r->head,r->head+n);
+}
+
+//Copies n bytes from p and publishes them; n<=RingFree.
+RingFn void RingWrite(Ring *r, const void *p, uint32_t n){
+	uint32_t h=r->head&r->msk, k=r->msk+1-h;
+	if(k>n) k=n;
+	memcpy(r->buf+h,p,k);
+	memcpy(r->buf,(const uint8_t *)p+k,n-k);
+	RingSt(r->head,r->head+n);
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*
+Raw socket session of WGPIB firmware, see scpi.h.
+A message from the client ends with LF; it is written to the device with EOI on
+the LF. LF within a definite length block (#<d><length><data>) does not end it.
+If the message contains '?' outside of blocks, the response is read up to EOI
+and sent to the client. There is no escaping and no command of the adapter.
+Data is not copied by the session: recv writes into GpWrR, send takes from GpRdR.
+The bus is held (GpLock, class GcQuery) from the first byte of a message up to
+the end of its response; a message which is not ended within ScpiTmo is sent
+without EOI, so a stalled client does not hold the bus. A long response is read
+in parts of GpChunk bytes; between them the bus is given to waiting sessions of
+other devices and the device is addressed to talk again. Bus errors are not reported to the client (the
+response is missing), they are counted in the metrics.
+*/
+
+#include <Arduino.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <netinet/tcp.h>
+#include "gpib.h"
+#include "scpi.h"
+
+#define ScpiCtl 0				// GPIB address of the controller
+#define ScpiTmo 2000			// Rest of a message is waited for up to this time, ms
+#define ScpiSockBuf 16384		// Socket buffers; lwIP may limit them (TCP_WND, TCP_SND_BUF)
+
+typedef struct{
+	int fd;
+	uint8_t addr;			// GPIB address of the device
+	uint8_t end;			// Connection closed or failed
+	ScpiSt t;				// Scan of the current message
+	uint8_t *lp;			// Bytes of the next message in GpWrR, received with this one
+	uint32_t pend;
+	GpSes ses;
+} Scpi;
+
+
+/*
+Routine scans n received bytes at p for the end of the message (LF) and for '?',
+skipping definite length blocks. Returns number of bytes which belong to the
+message; t->eom is set if it ends there. Also used by the HiSLIP session.
+*/
+uint32_t ScpiScan(ScpiSt *t, const uint8_t *p, uint32_t n){
+	uint32_t i;
+	uint8_t c;
+	for(i=0;i<n;i++){
+		c=p[i];
+		if(t->cnt) {t->cnt--; continue;}	// Block data
+		if(t->blk==1){						// After '#'
+			t->blk=0;
+			if(c>'0' && c<='9') {t->dig=c-'0'; t->len=0; t->blk=2; continue;}
+		}
+		else if(t->blk==2){					// Block length
+			if(c>='0' && c<='9'){
+				t->len=t->len*10+c-'0';
+				if(!--t->dig) {t->cnt=t->len; t->blk=0;}
+				continue;
+			}
+			t->blk=0;
+		}
+		if(c=='#') t->blk=1;
+		else if(c=='?') t->q=1;
+		else if(c=='\n'){
+			t->eom=1;
+			return i+1;
+		}
+	}
+	return n;
+}
+
+
+//Routine waits up to ms until the socket is readable. Returns 0 on timeout.
+static uint8_t ScpiWait(Scpi *s, uint32_t ms){
+	fd_set fs;
+	struct timeval tv;
+	FD_ZERO(&fs);
+	FD_SET(s->fd,&fs);
+	tv.tv_sec=ms/1000;
+	tv.tv_usec=ms%1000*1000;
+	return select(s->fd+1,&fs,0,0,&tv)>0;
+}
+
+
+/*
+Routine receives into free space of GpWrR and publishes the bytes. Sets p to them.
+Returns number of bytes, 0 if there are none or the connection ended (s->end).
+*/
+static uint32_t ScpiRecv(Scpi *s, uint8_t **p){
+	uint32_t k;
+	int r;
+	k=RingWrSpan(&GpWrR,p);
+	if(!k) {GpWait(1); return 0;}		// Engine did not take data yet
+	r=recv(s->fd,*p,k,MSG_DONTWAIT);
+	if(r>0){
+		RingWrDone(&GpWrR,r);
+		return r;
+	}
+	if(!r || (errno!=EAGAIN && errno!=EWOULDBLOCK)) s->end=1;
+	else ScpiWait(s,10);
+	return 0;
+}
+
+
+//Routine sends n bytes. Returns 0 if the connection failed.
+static uint8_t ScpiSend(Scpi *s, const uint8_t *p, uint32_t n){
+	int k;
+	while(n && !s->end){
+		k=send(s->fd,p,n,0);
+		if(k<=0) s->end=1;
+		else {p+=k; n-=k;}
+	}
+	return !s->end;
+}
+
+
+//Routine reads response of the device to the client. Returns result byte.
+static uint8_t ScpiRead(Scpi *s){
+	GpOp o={GoRead,RdEOI,0,0,GpChunk}, st={GoStop,0,0,0,0};
+	GpEv e;
+	uint8_t *p, ev, stop=0, adr=1;
+	uint32_t n;
+	for(;;){
+		if(adr && GpDo(GoAddr,GfTalk,s->addr,ScpiCtl,&e)!=ACK) return e.res;
+		GpPut(&o);
+		for(;;){
+			ev=GpGet(&e,0);
+			while((n=RingRdSpan(&GpRdR,&p))){	// Data before the event is in the ring
+				if(!ScpiSend(s,p,n) && !stop){
+					GpPut(&st);					// Client is gone
+					stop=1;
+				}
+				RingSkip(&GpRdR,n);
+			}
+			if(ev) break;
+			GpWait(1);
+		}
+		if(e.res!=ACK || e.eoi || stop || e.n<o.n) return e.res;
+		adr=!s->pend && GpYield(&s->ses,GcBulk);	// Next message in GpWrR keeps the bus
+	}
+}
+
+
+/*
+Routine forwards one message to the device and its response to the client.
+The caller holds GpLock. Returns 0 if the connection ended and nothing is left.
+*/
+static uint8_t ScpiMsg(Scpi *s){
+	GpOp o={GoAddr,0,s->addr,0,ScpiCtl};
+	GpEv e;
+	uint8_t *p, res=ACK, nev=0;
+	uint32_t k, m, t=millis();
+	memset(&s->t,0,sizeof(s->t));
+	for(;;){
+		if(s->pend){
+			p=s->lp;
+			k=s->pend;
+			s->pend=0;
+		}
+		else if(s->end || millis()-t>=ScpiTmo) k=0;
+		else{
+			k=ScpiRecv(s,&p);
+			if(!k) continue;
+			t=millis();
+		}
+		if(!k && o.op==GoAddr) return !s->end;	// No message
+		m=ScpiScan(&s->t,p,k);
+		if(m<k){							// Next message
+			s->lp=p+m;
+			s->pend=k-m;
+		}
+		if(o.op==GoAddr){
+			GpPut(&o);
+			nev++;
+			o.op=GoWrite;
+			o.flg=GfNew;
+			o.arg=0;
+		}
+		o.n=m;
+		if(s->t.eom) o.flg|=GfEnd|GfEOI;
+		else if(!k) o.flg|=GfEnd;			// Ended without LF
+		GpPut(&o);
+		if(o.flg&GfEnd) break;
+		o.flg=0;
+	}
+	for(nev++;nev;nev--){					// GoAddr and the message
+		while(!GpGet(&e,1000));
+		if(e.res!=ACK) res=e.res;
+	}
+	if(s->t.q && res==ACK) ScpiRead(s);
+	return !s->end || s->pend;
+}
+
+
+/*
+Routine runs raw socket session on connection fd bound to GPIB address addr until
+it is closed.
+*/
+void ScpiRun(int fd, uint8_t addr){
+	Scpi s;
+	int on=1, b=ScpiSockBuf;
+	memset(&s,0,sizeof(s));
+	s.fd=fd;
+	s.addr=addr;
+	GpSesInit(&s.ses,1);
+	s.ses.dev=GpDev(addr);
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+	setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,&on,sizeof(on));	// Persistent session
+	setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&b,sizeof(b));
+	setsockopt(fd,SOL_SOCKET,SO_SNDBUF,&b,sizeof(b));
+	for(;;){
+		while(!ScpiWait(&s,1000));
+		GpLock(&s.ses,GcQuery);
+		while(ScpiMsg(&s) && s.pend);	// Bytes of the next message are in GpWrR already
+		GpUnlock(&s.ses);
+		if(s.end && !s.pend) break;
+	}
+	GpSesEnd(&s.ses);
+}
@@ -0,0 +1,24 @@
+/*
+Raw socket session of WGPIB firmware (LXI port 5025 convention).
+A TCP connection is bound to one GPIB address; bytes are forwarded as they are.
+*/
+
+#ifndef SCPI_H
+#define SCPI_H
+
+#include <stdint.h>
+
+// State of ScpiScan, zeroed at the beginning of a message
+typedef struct{
+	uint8_t eom;			// End of the message (LF) found
+	uint8_t q;				// Message is a query
+	uint8_t blk;			// Block header: 1 after '#', 2 in length digits
+	uint8_t dig;			// Length digits left
+	uint32_t len;			// Block length being received
+	uint32_t cnt;			// Block data bytes left
+} ScpiSt;
+
+uint32_t ScpiScan(ScpiSt *t, const uint8_t *p, uint32_t n);
+void ScpiRun(int fd, uint8_t addr);
+
+#endif
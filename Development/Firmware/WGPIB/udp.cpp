@@ -0,0 +1,266 @@
+/*
+UDP streaming of WGPIB firmware, see udp.h.
+A read is done in parts of UdpPay bytes; each part is one datagram, sent as
+soon as it is read, so the stream does not wait for ACKs as TCP does. The last
+UdpWin datagrams are kept for requests N. The receiver finds lost datagrams by
+gaps in sequence numbers; as the last datagram of a read can be lost too, a
+heartbeat with the next sequence number is sent after UdpBeat without data.
+The bus is held (class GcQuery) for the message; the read gives it to waiting
+sessions of other devices between parts (GpYield). Requests of the receiver are served between
+parts as well.
+*/
+
+#include <Arduino.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+#include "gpib.h"
+#include "udp.h"
+
+#define UdpCtl 0				// GPIB address of the controller
+#define UdpWin 16				// Datagrams kept for sending again, power of 2
+#define UdpBeat 1000			// Heartbeat after this time without datagram, ms
+
+typedef struct{
+	int fd;
+	uint8_t reg;				// Receiver registered
+	uint8_t in;					// ses is registered at the scheduler, while reg is set
+	struct sockaddr_in rx;		// Receiver
+	uint32_t seq;				// Next sequence number
+	uint32_t rd;				// Number of the last read
+	uint8_t poll;				// Polling: 1 periodic, 2 once
+	uint8_t addr;				// Polled device
+	uint8_t ra;					// Device of the current read
+	uint32_t per;				// Poll period, ms
+	uint32_t tp, tb;			// Start of the last poll, time of the last datagram
+	uint16_t mlen;
+	uint8_t msg[UdpPay];		// Message of the poll
+	GpSes ses;
+} Udp;
+
+static Udp U;
+static uint8_t UdpW[UdpWin][UdpHdr+UdpPay];	// Sent datagrams, at seq%UdpWin
+static uint16_t UdpWLen[UdpWin];
+static uint32_t UdpCnt, UdpRetx, UdpGone;		// Datagrams sent, sent again, requested but gone
+
+static void Le32(uint8_t *p, uint32_t v){
+	p[0]=v; p[1]=v>>8; p[2]=v>>16; p[3]=v>>24;
+}
+
+static uint32_t Get32(const uint8_t *p){
+	return (uint32_t)p[3]<<24|(uint32_t)p[2]<<16|(uint32_t)p[1]<<8|p[0];
+}
+
+
+//Routine waits up to ms until the socket is readable. Returns 0 on timeout.
+static uint8_t UdpWait(uint32_t ms){
+	fd_set fs;
+	struct timeval tv;
+	FD_ZERO(&fs);
+	FD_SET(U.fd,&fs);
+	tv.tv_sec=ms/1000;
+	tv.tv_usec=ms%1000*1000;
+	return select(U.fd+1,&fs,0,0,&tv)>0;
+}
+
+//Routine sends n bytes at p to the receiver. lwIP fails with ENOMEM while its buffers are full.
+static void UdpSend(const uint8_t *p, uint32_t n){
+	uint8_t k;
+	for(k=0;k<20;k++){
+		if(sendto(U.fd,p,n,0,(struct sockaddr *)&U.rx,sizeof(U.rx))>=0 || errno!=ENOMEM) break;
+		vTaskDelay(1);
+	}
+	U.tb=millis();
+}
+
+//Routine sends datagram without data: heartbeat or UfGone of seq.
+static void UdpEmpty(uint32_t seq, uint8_t flg){
+	uint8_t h[UdpHdr];
+	memset(h,0,sizeof(h));
+	Le32(h,seq);
+	Le32(h+4,U.rd);
+	h[12]=flg;
+	h[13]=U.ra;
+	UdpSend(h,sizeof(h));
+}
+
+
+/*
+Routine sends n bytes of data in GpRdR as the next datagram of the read, at
+offset off; flg and res as in the header. The datagram is kept in the window.
+*/
+static void UdpData(uint32_t off, uint32_t n, uint8_t flg, uint8_t res){
+	uint32_t i=U.seq%UdpWin;
+	uint8_t *p=UdpW[i];
+	Le32(p,U.seq);
+	Le32(p+4,U.rd);
+	Le32(p+8,off);
+	p[12]=flg;
+	p[13]=U.ra;
+	p[14]=res;
+	p[15]=0;
+	RingRead(&GpRdR,p+UdpHdr,n);
+	UdpWLen[i]=UdpHdr+n;
+	U.seq++;
+	if(!U.reg) return;				// Unregistered during the read
+	UdpSend(p,UdpHdr+n);
+	UdpCnt++;
+}
+
+//Routine sends again n datagrams from seq.
+static void UdpResend(uint32_t seq, uint32_t n){
+	uint8_t *p;
+	if(n>UdpWin) n=UdpWin;
+	for(;n;n--,seq++){
+		p=UdpW[seq%UdpWin];
+		if(seq-U.seq<0x80000000 || U.seq-seq>UdpWin || Get32(p)!=seq){	// Not sent yet or gone
+			UdpEmpty(seq,UfGone);
+			UdpGone++;
+			continue;
+		}
+		p[12]|=UfRetx;
+		UdpSend(p,UdpWLen[seq%UdpWin]);
+		UdpRetx++;
+	}
+}
+
+
+//Routine receives one datagram from the receiver, if there is one, and executes it.
+static void UdpReq(void){
+	uint8_t c[UdpPay+32];
+	struct sockaddr_in a;
+	socklen_t al=sizeof(a);
+	char *e;
+	uint32_t x, y;
+	int n;
+	n=recvfrom(U.fd,c,sizeof(c)-1,MSG_DONTWAIT,(struct sockaddr *)&a,&al);
+	if(n<=0) return;
+	c[n]=0;
+	if(c[0]=='R'){
+		U.rx=a;
+		U.reg=1;
+		U.seq=0;
+		U.poll=0;
+		memset(UdpWLen,0,sizeof(UdpWLen));
+		memset(UdpW,0xff,sizeof(UdpW));		// No valid sequence number
+		UdpEmpty(0,UfBeat);
+		return;
+	}
+	if(!U.reg || a.sin_addr.s_addr!=U.rx.sin_addr.s_addr || a.sin_port!=U.rx.sin_port) return;
+	switch(c[0]){
+	case 'P':
+		x=strtoul((char *)c+1,&e,10);
+		if(*e!=',' || !x || x>30) break;
+		y=strtoul(e+1,&e,10);
+		if(*e!=',' || (uint8_t *)e+1-c>=n) break;
+		U.addr=x;
+		U.per=y;
+		U.mlen=n-((uint8_t *)e+1-c);
+		if(U.mlen>UdpPay) U.mlen=UdpPay;
+		memcpy(U.msg,e+1,U.mlen);
+		U.poll=y ? 1 : 2;
+		U.tp=millis()-y;				// First read now
+		break;
+	case 'S':
+		U.poll=0;
+		break;
+	case 'N':
+		x=strtoul((char *)c+1,&e,10);
+		y=*e==',' ? strtoul(e+1,0,10) : 1;
+		UdpResend(x,y);
+		break;
+	case 'U':
+		U.reg=0;
+		U.poll=0;
+		break;
+	}
+}
+
+
+//Routine writes the message of the poll to the device and streams its response.
+static void UdpPoll(void){
+	GpOp o={GoAddr,0,U.addr,0,UdpCtl}, r={GoRead,RdEOI,0,0,UdpPay};
+	GpEv e;
+	uint32_t off=0;
+	uint8_t res=ACK, k;
+	U.rd++;
+	U.ra=U.addr;						// Requests during the read may change the poll
+	U.ses.dev=GpDev(U.ra);
+	GpLock(&U.ses,GcQuery);
+	GpPut(&o);
+	GpData(U.msg,U.mlen);
+	o.op=GoWrite;
+	o.flg=GfNew|GfEnd|GfEOI;
+	o.arg=0;
+	o.n=U.mlen;
+	GpPut(&o);
+	for(k=0;k<2;k++){					// GoAddr and the message
+		while(!GpGet(&e,1000));
+		if(e.res!=ACK) res=e.res;
+	}
+	if(res==ACK) res=GpDo(GoAddr,GfTalk,U.ra,UdpCtl,&e);
+	while(res==ACK){
+		GpPut(&r);
+		while(!GpGet(&e,10));
+		res=e.res;
+		if(res!=ACK || e.eoi || e.n<r.n) break;
+		UdpData(off,e.n,0,0);
+		off+=e.n;
+		UdpReq();						// Requests of the receiver
+		if(GpYield(&U.ses,GcBulk)) res=GpDo(GoAddr,GfTalk,U.ra,UdpCtl,&e);
+	}
+	UdpData(off,RingUsed(&GpRdR),UfLast,res);
+	GpUnlock(&U.ses);
+}
+
+
+//Routine runs UDP streaming on port; it does not return.
+void UdpRun(uint16_t port){
+	struct sockaddr_in a;
+	uint32_t t;
+	memset(&U,0,sizeof(U));
+	memset(UdpW,0xff,sizeof(UdpW));
+	for(;;){
+		U.fd=socket(AF_INET,SOCK_DGRAM,0);
+		memset(&a,0,sizeof(a));
+		a.sin_family=AF_INET;
+		a.sin_port=htons(port);
+		a.sin_addr.s_addr=htonl(INADDR_ANY);
+		if(U.fd>=0 && bind(U.fd,(struct sockaddr *)&a,sizeof(a))==0) break;
+		if(U.fd>=0) close(U.fd);
+		vTaskDelay(1000);
+	}
+	for(;;){
+		t=UdpBeat;
+		if(U.poll){						// Up to the next poll
+			t=millis()-U.tp;
+			t=t<U.per ? U.per-t : 0;
+			if(t>UdpBeat) t=UdpBeat;
+		}
+		if(UdpWait(t)) UdpReq();
+		if(U.in!=U.reg){				// Session of the scheduler only with a receiver, see GpSesAlone
+			if(U.reg) GpSesInit(&U.ses,1);
+			else GpSesEnd(&U.ses);
+			U.in=U.reg;
+		}
+		if(U.poll && millis()-U.tp>=U.per){
+			U.tp+=U.per;
+			if(millis()-U.tp>=U.per) U.tp=millis();	// Reads take longer than the period
+			if(U.poll==2) U.poll=0;
+			UdpPoll();
+		}
+		if(U.reg && millis()-U.tb>=UdpBeat) UdpEmpty(U.seq,UfBeat);
+	}
+}
+
+
+//Routine writes counters of UDP streaming in Prometheus exposition format to p. Returns the length.
+int UdpMetrics(char *p, int max){
+	int n;
+	if(max<=0) return 0;
+	n=snprintf(p,max,
+		"# TYPE gpib_udp_datagrams_total counter\ngpib_udp_datagrams_total %u\n"
+		"# TYPE gpib_udp_retransmits_total counter\ngpib_udp_retransmits_total %u\n"
+		"# TYPE gpib_udp_gone_total counter\ngpib_udp_gone_total %u\n",
+		(unsigned)UdpCnt,(unsigned)UdpRetx,(unsigned)UdpGone);
+	return n<max ? n : max-1;
+}
@@ -0,0 +1,41 @@
+/*
+UDP streaming of WGPIB firmware. Reads of a polled device are sent to one
+registered receiver as sequenced datagrams; lost ones are requested again.
+
+Datagram to the receiver: header of UdpHdr bytes (numbers LSB first), then data.
+	0	sequence number, consecutive over all data datagrams
+	4	number of the read
+	8	offset of the data in the read
+	12	flags UfXxx
+	13	GPIB address of the device
+	14	result byte of the read (ACK or error), in the last datagram of the read
+	15	0
+Datagram from the receiver, to port UdpPort (text; numbers decimal):
+	R				Registers the sender as the receiver; sequence restarts at 0, polling stops
+	P<a>,<ms>,<m>	Writes message m (rest of the datagram, with EOI on its last byte)
+					to device a every ms (0: once) and reads its response up to EOI
+	S				Stops polling
+	N<seq>[,<n>]	Sends again n datagrams (default 1) from seq; UfGone if one is
+					not in the window anymore
+	U				Unregisters the receiver
+Only R is accepted from other senders than the receiver.
+*/
+
+#ifndef UDP_H
+#define UDP_H
+
+#include <stdint.h>
+
+#define UdpHdr 16
+#define UdpPay 1400			// Data bytes of a datagram; with headers below Ethernet MTU
+
+// Flags of the header
+#define UfLast 0x01			// Last datagram of the read; the result byte is valid
+#define UfRetx 0x02			// Sent again on request
+#define UfBeat 0x04			// Heartbeat when idle: no data, sequence number is the next one
+#define UfGone 0x08			// Requested datagram is not in the window; no data
+
+void UdpRun(uint16_t port);
+int UdpMetrics(char *p, int max);
+
+#endif
@@ -0,0 +1,143 @@
+"""
+Checks of the block commands of USB GPIB Controller firmware BSC.C V2.5
+(Documents/hardware/bsc/ATmega8515) on an adapter. The commands receive
+<DLE><STX><data><DLE><ETX> after the command letter and return <ACK> or <NAK>.
+
+The checks use the adapter alone; no instrument may be connected.
+The firmware has to be built with the options of the commands checked
+(OptScript, OptPoll, OptGroup, OptCache, OptCoal); the defaults include OptGroup only.
+Needs pyserial. Usage: python bsccheck.py <port of the adapter>
+"""
+
+import sys
+import time
+
+import serial
+
+STX, ETX, ACK, DLE, NAK, ESC = 0x02, 0x03, 0x06, 0x10, 0x15, 0x1B
+
+
+class Adapter:
+    def __init__(self, port):
+        self.s = serial.Serial(port, 115200, timeout=2)  # FT245: the rate is not used
+        self.s.reset_input_buffer()
+
+    def send(self, b):
+        self.s.write(b)
+
+    def cmd(self, c, block=None):
+        """Sends command IB<c>; with block it is sent as a data block, else ended by CR."""
+        b = b"IB" + c
+        if block is None:
+            b += b"\r"
+        else:
+            b += bytes([DLE, STX]) + block.replace(b"\x10", b"\x10\x10") + bytes([DLE, ETX])
+        self.send(b)
+
+    def res(self, tmo=2.0):
+        """Returns the next return byte, None if none came within tmo."""
+        self.s.timeout = tmo
+        r = self.s.read(1)
+        return r[0] if r else None
+
+
+def check(name, ok):
+    print("%-40s %s" % (name, "ok" if ok else "FAILED"))
+    return ok
+
+
+def check_script(a):
+    """IBs stores the script (ACK), IBx runs it; a wait is stopped by the PC."""
+    ok = True
+    a.cmd(b"s", bytes([0x06, 50, 0, 0x00]))  # Wait 50 ms, end
+    ok &= check("IBs<block> returns ACK", a.res(10) == ACK)
+    t = time.time()
+    a.cmd(b"x")
+    r = a.res()
+    ok &= check("IBx runs the stored script", r == ACK and time.time() - t >= 0.05)
+    a.cmd(b"s", bytes([0x06, 0xFF, 0xFF, 0x00]))  # Wait 65.535 s
+    ok &= check("IBs<block> with wait over 32767 ms", a.res(10) == ACK)
+    a.cmd(b"x")
+    time.sleep(0.3)
+    a.send(bytes([ESC]))
+    ok &= check("IBx wait is stopped by the PC", a.res(1) == ACK)
+    a.cmd(b"s", b"")
+    ok &= check("IBs with empty block returns ACK", a.res(10) == ACK)
+    a.cmd(b"x")
+    ok &= check("IBx of empty script returns ACK", a.res() == ACK)
+    a.cmd(b"s", bytes(300))
+    ok &= check("IBs with too long script returns NAK", a.res(10) == NAK)
+    return ok
+
+
+def check_poll(a):
+    """IBp sets an entry of the polling table (ACK); an invalid one returns NAK."""
+    ok = True
+    a.cmd(b"p", bytes([0, 1, 0, 0]))  # Entry 0, address 1, disabled
+    ok &= check("IBp<block> returns ACK", a.res() == ACK)
+    a.cmd(b"p", bytes([0, 1, 0, 0]) + b"*STB?")
+    ok &= check("IBp<block> with query returns ACK", a.res() == ACK)
+    a.cmd(b"p", bytes([0, 1, 0, 0]) + b"*STB?")
+    a.cmd(b"p", bytes([9, 1, 0, 0]))
+    ok &= check("IBp<block> in a row", a.res() == ACK and a.res() == NAK)
+    a.cmd(b"p", bytes([0, 1, 0, 0]))  # Leave the entry disabled
+    a.res()
+    return ok
+
+
+def check_group(a):
+    """IBg checks the device list; without instruments the trigger finds no listener."""
+    ok = True
+    a.cmd(b"g", bytes([1]))
+    ok &= check("IBg<block> with invalid list returns NAK", a.res() == NAK)
+    a.cmd(b"g", bytes([1, 0x00, 2, 0x00]))
+    ok &= check("IBg<block> without listeners returns 8", a.res() == 8)
+    a.cmd(b"")
+    ok &= check("IB after IBg returns ACK", a.res() == ACK)
+    return ok
+
+
+def check_cache(a):
+    """IBk writes the query to the device; without instruments it finds no listener."""
+    ok = True
+    a.cmd(b"K100")
+    ok &= check("IBK returns ACK", a.res() == ACK)
+    a.cmd(b"k", bytes([1]))
+    ok &= check("IBk<block> without query returns NAK", a.res() == NAK)
+    a.cmd(b"k", bytes([1]) + b"*IDN?")
+    ok &= check("IBk<block> without listeners returns 8", a.res() == 8)
+    a.cmd(b"K0")
+    a.res()
+    return ok
+
+
+def check_coal(a):
+    """IBw buffers the write (ACK); IBW flushes it and finds no listener."""
+    ok = True
+    a.cmd(b"W0")
+    a.res()
+    a.cmd(b"W1000")  # Window longer than the check
+    ok &= check("IBW<win> returns ACK", a.res() == ACK)
+    a.cmd(b"w", bytes([1]) + b"*CLS\n")
+    ok &= check("IBw<block> returns ACK", a.res() == ACK)
+    a.cmd(b"W")
+    ok &= check("IBW flush without listeners returns 8", a.res() == 8)
+    a.cmd(b"W10")
+    a.res()
+    return ok
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__.strip())
+    a = Adapter(sys.argv[1])
+    ok = check_script(a)
+    ok &= check_poll(a)
+    ok &= check_group(a)
+    ok &= check_cache(a)
+    ok &= check_coal(a)
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
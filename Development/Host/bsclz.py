@@ -0,0 +1,103 @@
+"""
+Host decoder of compressed data blocks of WGPIB firmware (BSC command IBL1).
+
+The data of a block (after DLE unstuffing or COBS frames) is a sequence of
+chunks: raw length, packed length (2 bytes each, LSB first) and the packed LZ
+block, or the raw bytes if packed length is 0. The LZ format is described in
+Firmware/WGPIB/lz.h.
+
+Usage as a tool: python bsclz.py <block data file> [<output file>]
+"""
+
+import struct
+import sys
+
+
+def unpack_block(b, n):
+    """Decodes one LZ block b to n bytes."""
+    out = bytearray()
+    i = 0
+    while i < len(b):
+        t = b[i]
+        i += 1
+        nl = t >> 4
+        if nl == 15:
+            while True:
+                x = b[i]
+                i += 1
+                nl += x
+                if x != 255:
+                    break
+        out += b[i:i + nl]
+        i += nl
+        if i >= len(b):
+            break
+        d = b[i] | b[i + 1] << 8
+        i += 2
+        ml = t & 15
+        if ml == 15:
+            while True:
+                x = b[i]
+                i += 1
+                ml += x
+                if x != 255:
+                    break
+        ml += 4
+        if d == 0 or d > len(out):
+            raise ValueError("bad match offset")
+        if d >= ml:
+            out += out[-d:len(out) - d + ml]
+        else:
+            for _ in range(ml):  # Overlapping match
+                out.append(out[-d])
+    if len(out) != n:
+        raise ValueError("block length %d, expected %d" % (len(out), n))
+    return bytes(out)
+
+
+def unpack(data):
+    """Decodes the data of a compressed block (all chunks) to the read data."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        n, k = struct.unpack_from("<HH", data, i)
+        i += 4
+        if k:
+            out += unpack_block(data[i:i + k], n)
+            i += k
+        else:
+            out += data[i:i + n]
+            i += n
+    return bytes(out)
+
+
+class Decoder:
+    """Streaming decoder: feed data as it comes, returns decoded bytes of whole chunks."""
+
+    def __init__(self):
+        self.buf = bytearray()
+
+    def feed(self, data):
+        self.buf += data
+        out = bytearray()
+        while len(self.buf) >= 4:
+            n, k = struct.unpack_from("<HH", self.buf)
+            m = 4 + (k if k else n)
+            if len(self.buf) < m:
+                break
+            c = bytes(self.buf[4:m])
+            out += unpack_block(c, n) if k else c
+            del self.buf[:m]
+        return bytes(out)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        sys.exit(__doc__.strip())
+    with open(sys.argv[1], "rb") as f:
+        r = unpack(f.read())
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "wb") as f:
+            f.write(r)
+    else:
+        sys.stdout.buffer.write(r)
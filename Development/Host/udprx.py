@@ -0,0 +1,160 @@
+"""
+Receiver of UDP streaming of WGPIB firmware (Firmware/WGPIB/udp.h).
+
+Registers at the adapter, sets the poll of a device and writes its responses.
+Datagrams are put in order by sequence number; a gap, found by a later datagram
+or a heartbeat, is requested again with N. A read with a datagram which is not
+in the window of the adapter anymore (UfGone) is returned without data (None).
+
+Usage as a tool: python udprx.py <adapter> <address> <period ms> <message> [<reads>]
+	e.g. python udprx.py 192.168.1.20 5 100 "MEAS:VOLT?" 10
+The message is sent with LF; the period 0 reads once.
+"""
+
+import random
+import socket
+import struct
+import sys
+import time
+
+UDP_PORT = 5030
+UDP_HDR = 16
+UF_LAST, UF_RETX, UF_BEAT, UF_GONE = 0x01, 0x02, 0x04, 0x08
+RETRY = 0.2                     # A missing datagram is requested again after this time, s
+
+
+class Receiver:
+    """Receiver at adapter host; loss drops a part of the datagrams on purpose, for tests."""
+
+    def __init__(self, host, port=UDP_PORT, tmo=3.0, loss=0.0):
+        self.a = (host, port)
+        self.s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.s.settimeout(tmo)
+        self.loss = loss
+        self.naks = 0                   # Datagrams requested again
+        self.gone = 0                   # Of them not in the window anymore
+        self.reset()
+
+    def reset(self):
+        self.nxt = 0                    # Next sequence number to be put in order
+        self.got = {}                   # Datagrams received ahead of nxt, by sequence number
+        self.cur = None                 # Read being put together: [number, address, data, complete]
+        self.asked = {}                 # Time of the last request, by sequence number
+
+    def send(self, b):
+        self.s.sendto(b, self.a)
+
+    def get(self):
+        """Receives one datagram; returns header fields and data."""
+        while True:
+            d, a = self.s.recvfrom(65536)
+            if a[1] == self.a[1] and len(d) >= UDP_HDR:
+                break
+        seq, rd, off, flg, addr, res = struct.unpack("<IIIBBBx", d[:UDP_HDR])
+        return seq, rd, off, flg, addr, res, d[UDP_HDR:]
+
+    def register(self):
+        """Registers; returns 1 if the adapter answered with a heartbeat."""
+        self.reset()
+        self.send(b"R")
+        while True:
+            h = self.get()
+            if h[3] & UF_BEAT:
+                return h[0] == 0
+
+    def poll(self, addr, ms, msg):
+        self.send(b"P%d,%d," % (addr, ms) + msg + b"\n")
+
+    def stop(self):
+        self.send(b"S")
+
+    def unregister(self):
+        self.send(b"U")
+
+    def request(self, seq):
+        """Requests the missing datagrams before seq, each once per RETRY."""
+        t = time.time()
+        for q in range(self.nxt, seq):
+            if q in self.got or t - self.asked.get(q, 0) < RETRY:
+                continue
+            self.send(b"N%d" % q)
+            self.asked[q] = t
+            self.naks += 1
+
+    def take(self, h):
+        """Puts datagram h in order; returns the reads completed by it: number, address, result, data."""
+        seq = h[0]
+        out = []
+        if seq < self.nxt:
+            return out
+        self.got[seq] = h
+        while self.nxt in self.got:
+            seq, rd, off, flg, addr, res, d = self.got.pop(self.nxt)
+            self.asked.pop(seq, None)
+            self.nxt += 1
+            if flg & UF_GONE:
+                if self.cur is not None:
+                    self.cur[3] = False
+                continue
+            if self.cur is not None and self.cur[0] != rd:     # Its last datagram is gone
+                out.append((self.cur[0], self.cur[1], None, None))
+                self.cur = None
+            if self.cur is None:
+                self.cur = [rd, addr, bytearray(), off == 0]
+            self.cur[2] += d
+            if flg & UF_LAST:
+                out.append((rd, addr, res, bytes(self.cur[2]) if self.cur[3] else None))
+                self.cur = None
+        return out
+
+    def reads(self, n=None, tmo=None):
+        """Yields complete reads (see take) up to n of them or for tmo seconds."""
+        t = time.time()
+        while n is None or n > 0:
+            if tmo is not None and time.time() - t > tmo:
+                return
+            try:
+                h = self.get()
+            except socket.timeout:
+                return
+            seq, flg = h[0], h[3]
+            if flg & UF_BEAT:
+                self.request(seq)
+                continue
+            if flg & UF_GONE:
+                self.gone += 1
+            elif not flg & UF_RETX and random.random() < self.loss:
+                continue
+            if seq > self.nxt:
+                self.request(seq)
+            for r in self.take(h):
+                yield r
+                if n is not None:
+                    n -= 1
+                    if not n:
+                        return
+
+
+def main():
+    if len(sys.argv) < 5:
+        sys.exit(__doc__.strip())
+    r = Receiver(sys.argv[1])
+    if not r.register():
+        sys.exit("no heartbeat from the adapter")
+    ms = int(sys.argv[3])
+    r.poll(int(sys.argv[2]), ms, sys.argv[4].encode())
+    n = int(sys.argv[5]) if len(sys.argv) > 5 else (1 if ms == 0 else None)
+    try:
+        for rd, addr, res, d in r.reads(n):
+            if d is None:
+                print("read %d of %d: lost" % (rd, addr))
+            else:
+                sys.stdout.buffer.write(d)
+                sys.stdout.flush()
+    finally:
+        r.stop()
+        r.unregister()
+
+
+if __name__ == "__main__":
+    main()